@@ -0,0 +1,119 @@
+#include <plog/Log.h>
+#include <stdio.h>
+#include <sstream>
+#include <vector>
+
+#include "bench.h"
+#include "i2c.h"
+#include "trace.h"
+
+using namespace bench;
+
+static double rate(uint32_t size, uint64_t start) {
+	uint64_t duration = trace::now() - start;
+	return duration > 0 ? size * 1e9 / duration / 1024 : 0;
+}
+
+// Erases the block and programs it again, the program time only
+static double program(devices::device *device, uint8_t *data, uint32_t address, uint32_t size, bool pipeline) {
+	device->setProgramPipeline(pipeline);
+	device->eraseFlashBlock(address);
+
+	// Every page is programmed, the blank ones too: the runs have to be comparable
+	uint64_t start = trace::now();
+	device->programFlashContent(data, address, size, false);
+	double result = rate(size, start);
+
+	device->verifyFlashContent(data, address, size);
+	return result;
+}
+
+result_s bench::run(isp::session *session, uint32_t address) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	uint32_t size = flash->getBlockSize();
+	if (address % size != 0 || (uint64_t)address + size > flash->getSize()) {
+		std::stringstream msg;
+		msg << "The benchmark address has to be a " << std::dec << size / 1024 << " kb block inside the flash";
+		throw bench::exception(msg.str());
+	}
+	if (flash->getOpCode_blockErase() == -1) throw bench::exception("The flash chip hasnt got block erase support");
+
+	i2c::connection *connection = session->getConnection();
+
+	result_s result;
+	result.size = size;
+	result.raw = 0;
+	result.writeSize = i2c::SMBUS_BLOCK_MAX;
+
+	std::vector<uint8_t> data(size);
+
+	PLOG_INFO << "[bench] Read the block at 0x" << std::hex << address;
+	uint64_t start = trace::now();
+	device->readFlashContent(&data[0], address, size);
+	result.read = rate(size, start);
+
+	start = trace::now();
+	device->calculateCRC(address, address + size - 1);
+	result.crc = rate(size, start);
+
+	device->beginFlashWrite(false);
+	try {
+		PLOG_INFO << "[bench] Program with the serialized page upload";
+		connection->setMaxWriteSize(i2c::SMBUS_BLOCK_MAX);
+		result.serial = program(device, &data[0], address, size, false);
+
+		// The transfer size probe read only, the raw page writes are validated here
+		if (connection->getMaxTransferSize() > i2c::SMBUS_BLOCK_MAX) {
+			PLOG_INFO << "[bench] Program with " << std::dec << connection->getMaxTransferSize() << " byte raw page writes";
+			connection->setMaxWriteSize(connection->getMaxTransferSize());
+			try {
+				result.raw = program(device, &data[0], address, size, false);
+				result.writeSize = connection->getMaxWriteSize();
+			} catch (devices::exception &e) {
+				PLOG_WARNING << "[bench] " << e.what() << ", the raw writes are refused, restore the block";
+				connection->setMaxWriteSize(i2c::SMBUS_BLOCK_MAX);
+				program(device, &data[0], address, size, false);
+			}
+		}
+		PLOG_INFO << "[bench] Program with the overlapped page upload";
+		try {
+			result.overlapped = program(device, &data[0], address, size, true);
+		} catch (devices::exception &e) {
+			// The first overlapped page failed its check: the block is rewritten without the pipeline
+			if (device->hasProgramPipeline()) throw;
+			PLOG_WARNING << "[bench] " << e.what() << ", restore the block";
+			result.overlapped = program(device, &data[0], address, size, false);
+		}
+		// A passed check leaves the pipeline on for the rest of the session
+		device->setProgramPipeline(device->hasProgramPipeline());
+	} catch (...) {
+		device->setProgramPipeline(false);
+		connection->setMaxWriteSize(i2c::SMBUS_BLOCK_MAX);
+		try {
+			device->endFlashWrite();
+		} catch (...) {}
+		throw;
+	}
+	device->endFlashWrite();
+
+	// The next sessions of this device write pages in this size (a refused size resets it)
+	session->saveWriteSize();
+
+	result.pipeline = device->hasProgramPipeline();
+
+	return result;
+}
+
+void bench::print(result_s &result) {
+	printf("block:      %u byte\n", result.size);
+	printf("read:       %.1f kb/s (CRC checked)\n", result.read);
+	printf("crc:        %.1f kb/s\n", result.crc);
+	printf("program:    %.1f kb/s serialized\n", result.serial);
+	if (result.raw > 0) printf("            %.1f kb/s raw writes (%+.1f%%)\n", result.raw, result.serial > 0 ? 100.0 * (result.raw - result.serial) / result.serial : 0.0);
+	printf("write size: %u byte%s\n", result.writeSize, result.writeSize > i2c::SMBUS_BLOCK_MAX ? " (validated, saved for this device)" : "");
+	printf("            %.1f kb/s overlapped (%+.1f%%)%s\n", result.overlapped,
+		result.serial > 0 ? 100.0 * (result.overlapped - result.serial) / result.serial : 0.0,
+		result.pipeline ? "" : ", the controller didn't free the program SRAM early: serialized fallback");
+}
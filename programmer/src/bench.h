@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+
+namespace bench {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Throughput of one flash block on the real device: CRC checked read, hardware CRC, then
+		erase + program with SMBus page writes, with the probed raw write size and with the
+		overlapped page upload. The block is rewritten with its own content, it holds the same
+		bytes after the run. A raw write size that passed its CRC check is saved for the device
+		(isp::writeSizePath), the next sessions of the device write their pages in it.
+	*/
+
+	struct result_s {
+		uint32_t size;
+		double read;        // kb/s
+		double crc;         // kb/s
+		double serial;      // kb/s, program only (without the erase), SMBus page writes
+		double raw;         // kb/s, program only, raw page writes (0: the adapter has no raw support)
+		uint32_t writeSize; // the validated page write transfer
+		double overlapped;  // kb/s, program only
+		bool pipeline;      // the controller accepted the overlapped upload
+	};
+
+	result_s run(isp::session *session, uint32_t address);
+	void print(result_s &result);
+
+};
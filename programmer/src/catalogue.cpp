@@ -0,0 +1,343 @@
+#include <plog/Log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <set>
+
+#include "catalogue.h"
+#include "layout.h"
+
+using namespace catalogue;
+
+static uint32_t parseNumber(std::string value, int line) {
+	char *end;
+	unsigned long result = strtoul(value.c_str(), &end, 0);
+	if (value.empty() || *end != 0 || result > 0xFFFFFFFFul) {
+		std::stringstream msg;
+		msg << "line " << line << ": invalid number: " << value;
+		throw catalogue::exception(msg.str());
+	}
+	return result;
+}
+
+// Image pairs in the same group which the range tells apart
+static uint64_t separatedPairs(std::vector<int> &groups, std::vector<uint8_t> &crcs) {
+	std::map<int, uint64_t> groupSize;
+	std::map<std::pair<int, uint8_t>, uint64_t> sameCRC;
+
+	for (size_t i = 0; i < groups.size(); i++) {
+		groupSize[groups[i]]++;
+		sameCRC[std::make_pair(groups[i], crcs[i])]++;
+	}
+
+	uint64_t pairs = 0;
+	for (std::map<int, uint64_t>::iterator it = groupSize.begin(); it != groupSize.end(); ++it) pairs += it->second * (it->second - 1) / 2;
+	for (std::map<std::pair<int, uint8_t>, uint64_t>::iterator it = sameCRC.begin(); it != sameCRC.end(); ++it) pairs -= it->second * (it->second - 1) / 2;
+
+	return pairs;
+}
+
+static void loadIndex(std::string index, std::vector<std::string> &names, std::vector<std::string> &files) {
+	std::ifstream file(index.c_str());
+	if (!file) throw catalogue::exception("Unable to open the index: " + index);
+
+	std::string directory;
+	size_t slash = index.rfind('/');
+	if (slash != std::string::npos) directory = index.substr(0, slash + 1);
+
+	std::string line;
+	int number = 0;
+
+	while (std::getline(file, line)) {
+		number++;
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line = line.substr(0, comment);
+
+		std::istringstream tokens(line);
+		std::string name, image, rest;
+
+		if (!(tokens >> name)) continue;
+
+		std::stringstream msg;
+		msg << "line " << number << ": ";
+
+		if (!(tokens >> image) || (tokens >> rest)) throw catalogue::exception(msg.str() + "expected <name> <file>");
+		for (size_t i = 0; i < names.size(); i++) {
+			if (names[i] == name) throw catalogue::exception(msg.str() + "duplicated name: " + name);
+		}
+
+		if (image[0] != '/') image = directory + image;
+
+		names.push_back(name);
+		files.push_back(image);
+	}
+
+	if (names.empty()) throw catalogue::exception("The index has no images: " + index);
+}
+
+void catalogue::build(std::string index, catalogue_s &catalogue) {
+	std::vector<std::string> names, files;
+	loadIndex(index, names, files);
+
+	size_t count = names.size();
+	uint32_t maxSize = 0;
+
+	// CRC of every candidate range of every image, the ranges after the end of an image are blank
+	std::vector<std::vector<uint8_t> > crcs;
+	catalogue.entries.clear();
+	catalogue.ranges.clear();
+
+	// The sizes first, the candidate ranges cover the largest image
+	for (size_t i = 0; i < count; i++) {
+		layout::image image;
+		image.add(0, files[i]);
+
+		entry_s entry;
+		entry.name = names[i];
+		entry.size = image.size();
+		catalogue.entries.push_back(entry);
+
+		if (entry.size > maxSize) maxSize = entry.size;
+	}
+
+	uint32_t candidates = (maxSize + RANGE_SIZE - 1) / RANGE_SIZE;
+	crcs.assign(candidates, std::vector<uint8_t>(count));
+
+	for (size_t i = 0; i < count; i++) {
+		PLOG_INFO << "[catalogue] CRC the ranges of " << names[i];
+		layout::image image;
+		image.add(0, files[i]);
+		for (uint32_t c = 0; c < candidates; c++) crcs[c][i] = image.crc(c * RANGE_SIZE, RANGE_SIZE);
+	}
+
+	// Greedy probes: the range which separates the most pairs of the current groups
+	std::vector<int> groups(count, 0);
+	std::vector<bool> used(candidates, false);
+	size_t probes = 0;
+
+	while (1) {
+		uint64_t bestPairs = 0;
+		uint32_t best = 0;
+
+		for (uint32_t c = 0; c < candidates; c++) {
+			if (used[c]) continue;
+			uint64_t pairs = separatedPairs(groups, crcs[c]);
+			if (pairs > bestPairs) {
+				bestPairs = pairs;
+				best = c;
+			}
+		}
+
+		// Every image is alone in its group, or the rest can't be told apart
+		if (bestPairs == 0) break;
+
+		used[best] = true;
+		range_s range = {best * RANGE_SIZE, RANGE_SIZE, false};
+		catalogue.ranges.push_back(range);
+		probes++;
+
+		PLOG_DEBUG << "[catalogue] Probe 0x" << std::hex << range.address << " separates " << std::dec << bestPairs << " pair(s)";
+
+		std::map<std::pair<int, uint8_t>, int> split;
+		for (size_t i = 0; i < count; i++) {
+			std::pair<int, uint8_t> key(groups[i], crcs[best][i]);
+			if (!split.count(key)) {
+				int id = split.size();
+				split[key] = id;
+			}
+			groups[i] = split[key];
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = i + 1; j < count; j++) {
+			if (groups[i] == groups[j]) PLOG_WARNING << "[catalogue] " << names[i] << " and " << names[j] << " can't be told apart (same CRC on every range)";
+		}
+	}
+
+	// Confirm ranges: the most varied unused range of each part of the address space
+	for (int part = 0; part < CONFIRM_RANGES; part++) {
+		uint32_t first = (uint64_t)candidates * part / CONFIRM_RANGES;
+		uint32_t last = (uint64_t)candidates * (part + 1) / CONFIRM_RANGES;
+
+		int bestValues = -1;
+		uint32_t best = 0;
+
+		for (uint32_t c = first; c < last; c++) {
+			if (used[c]) continue;
+			int values = std::set<uint8_t>(crcs[c].begin(), crcs[c].end()).size();
+			if (values > bestValues) {
+				bestValues = values;
+				best = c;
+			}
+		}
+
+		if (bestValues == -1) continue;
+
+		used[best] = true;
+		range_s range = {best * RANGE_SIZE, RANGE_SIZE, true};
+		catalogue.ranges.push_back(range);
+	}
+
+	for (size_t r = 0; r < catalogue.ranges.size(); r++) {
+		uint32_t c = catalogue.ranges[r].address / RANGE_SIZE;
+		for (size_t i = 0; i < count; i++) catalogue.entries[i].crc.push_back(crcs[c][i]);
+	}
+
+	PLOG_INFO << "[catalogue] " << std::dec << count << " image(s), " << probes << " probe range(s) of " << candidates << " candidate(s)";
+}
+
+void catalogue::save(std::string filename, catalogue_s &catalogue) {
+	FILE *fp = fopen(filename.c_str(), "w");
+	if (fp == NULL) throw catalogue::exception("Unable to create the catalogue: " + filename);
+
+	fprintf(fp, "# odc_prog firmware catalogue, see catalogue.h\n");
+
+	for (size_t r = 0; r < catalogue.ranges.size(); r++) {
+		range_s &range = catalogue.ranges[r];
+		fprintf(fp, "range 0x%06x 0x%x %s\n", range.address, range.size, range.confirm ? "confirm" : "probe");
+	}
+
+	for (size_t i = 0; i < catalogue.entries.size(); i++) {
+		entry_s &entry = catalogue.entries[i];
+		fprintf(fp, "image %s 0x%x", entry.name.c_str(), entry.size);
+		for (size_t r = 0; r < entry.crc.size(); r++) fprintf(fp, " %02x", entry.crc[r]);
+		fprintf(fp, "\n");
+	}
+
+	bool failed = ferror(fp);
+	if (fclose(fp) != 0 || failed) throw catalogue::exception("Unable to write the catalogue: " + filename);
+}
+
+void catalogue::load(std::string filename, catalogue_s &catalogue) {
+	std::ifstream file(filename.c_str());
+	if (!file) throw catalogue::exception("Unable to open the catalogue: " + filename);
+
+	catalogue.ranges.clear();
+	catalogue.entries.clear();
+
+	std::string line;
+	int number = 0;
+
+	while (std::getline(file, line)) {
+		number++;
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line = line.substr(0, comment);
+
+		std::istringstream tokens(line);
+		std::string type;
+		if (!(tokens >> type)) continue;
+
+		std::stringstream msg;
+		msg << "line " << number << ": ";
+
+		if (type == "range") {
+			if (!catalogue.entries.empty()) throw catalogue::exception(msg.str() + "the ranges have to be before the images");
+
+			std::string address, size, kind;
+			if (!(tokens >> address >> size >> kind) || (kind != "probe" && kind != "confirm")) throw catalogue::exception(msg.str() + "expected range <address> <size> probe|confirm");
+
+			range_s range = {parseNumber(address, number), parseNumber(size, number), kind == "confirm"};
+			if (range.size == 0) throw catalogue::exception(msg.str() + "empty range");
+			catalogue.ranges.push_back(range);
+		} else if (type == "image") {
+			entry_s entry;
+			std::string size, crc;
+			if (!(tokens >> entry.name >> size)) throw catalogue::exception(msg.str() + "expected image <name> <size> <CRCs>");
+			entry.size = parseNumber(size, number);
+
+			while (tokens >> crc) {
+				uint32_t value = parseNumber("0x" + crc, number);
+				if (value > 0xFF) throw catalogue::exception(msg.str() + "invalid CRC-8: " + crc);
+				entry.crc.push_back(value);
+			}
+			if (entry.crc.size() != catalogue.ranges.size()) throw catalogue::exception(msg.str() + "the image needs one CRC per range");
+
+			catalogue.entries.push_back(entry);
+		} else throw catalogue::exception(msg.str() + "unknown line: " + type);
+	}
+
+	if (catalogue.entries.empty()) throw catalogue::exception("The catalogue has no images: " + filename);
+}
+
+match_s catalogue::identify(isp::session *session, catalogue_s &catalogue) {
+	devices::device *device = session->getDevice();
+	uint32_t flashSize = session->getFlash()->getSize();
+
+	match_s match = {-1, -1, 0, 0, 0};
+
+	// An image larger than the flash can't be on the device
+	std::vector<int> candidates;
+	for (size_t i = 0; i < catalogue.entries.size(); i++) {
+		if (catalogue.entries[i].size <= flashSize) candidates.push_back(i);
+	}
+
+	std::map<size_t, uint8_t> probed;
+
+	for (size_t r = 0; r < catalogue.ranges.size() && candidates.size() > 1; r++) {
+		range_s &range = catalogue.ranges[r];
+		if (range.confirm || (uint64_t)range.address + range.size > flashSize) continue;
+
+		// Only the ranges which still separate the candidates cost a transaction
+		std::set<uint8_t> values;
+		for (size_t i = 0; i < candidates.size(); i++) values.insert(catalogue.entries[candidates[i]].crc[r]);
+		if (values.size() < 2) continue;
+
+		uint8_t crc = device->calculateCRC(range.address, range.address + range.size - 1);
+		probed[r] = crc;
+		match.probes++;
+
+		PLOG_DEBUG << "[catalogue] Probe 0x" << std::hex << range.address << ": " << std::setfill('0') << std::setw(2) << (int)crc;
+
+		std::vector<int> remaining;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			if (catalogue.entries[candidates[i]].crc[r] == crc) remaining.push_back(candidates[i]);
+		}
+
+		if (remaining.empty()) {
+			// Unknown firmware, the candidates were together until this range
+			match.closest = candidates[0];
+			candidates.clear();
+			break;
+		}
+		candidates = remaining;
+	}
+
+	if (candidates.empty()) return match;
+
+	// The last candidate (or the first one of the indistinguishable ones) against the confirm ranges
+	int candidate = candidates[0];
+	entry_s &entry = catalogue.entries[candidate];
+
+	for (size_t r = 0; r < catalogue.ranges.size(); r++) {
+		range_s &range = catalogue.ranges[r];
+		if (!range.confirm || (uint64_t)range.address + range.size > flashSize) continue;
+
+		uint8_t crc = device->calculateCRC(range.address, range.address + range.size - 1);
+		match.probes++;
+		match.confirmRanges++;
+		if (crc == entry.crc[r]) match.confirmed++;
+	}
+
+	if (match.confirmed == match.confirmRanges) match.entry = candidate;
+	else match.closest = candidate;
+
+	return match;
+}
+
+void catalogue::print(catalogue_s &catalogue, match_s &match) {
+	if (match.entry != -1) {
+		printf("firmware: %s (%d hardware CRC(s), %d/%d confirm ranges)\n", catalogue.entries[match.entry].name.c_str(),
+			match.probes, match.confirmed, match.confirmRanges);
+	} else if (match.closest != -1) {
+		printf("firmware: unknown, closest %s (%d hardware CRC(s), %d/%d confirm ranges)\n", catalogue.entries[match.closest].name.c_str(),
+			match.probes, match.confirmed, match.confirmRanges);
+	} else {
+		printf("firmware: unknown (%d hardware CRC(s))\n", match.probes);
+	}
+}
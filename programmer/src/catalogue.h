@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+
+namespace catalogue {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Catalogue of the known firmware images, identified by hardware CRCs of a few ranges
+		instead of a full download.
+
+		Index of the build: one image per line, '#' starts a comment, the relative file names
+		are relative to the index
+
+			<name> <file>
+
+		Catalogue file (written by build / save):
+
+			range <address> <size> probe|confirm
+			image <name> <size> <CRC-8 of every range, in the order of the ranges>
+
+		The probe ranges are chosen greedily: each one separates the most image pairs which
+		the previous ranges left together, until every image is told apart. The confirm ranges
+		are the most varied of the rest, spread over the address space: they check the result,
+		a modified or an unknown firmware can match the probes by accident.
+	*/
+
+	// Size of the candidate ranges
+	const uint32_t RANGE_SIZE = 4 * 1024;
+	const int CONFIRM_RANGES = 3;
+
+	struct range_s {
+		uint32_t address;
+		uint32_t size;
+		bool confirm;
+	};
+
+	struct entry_s {
+		std::string name;
+		uint32_t size;
+		std::vector<uint8_t> crc; // one per range
+	};
+
+	struct catalogue_s {
+		std::vector<range_s> ranges; // the probes in their order, then the confirm ranges
+		std::vector<entry_s> entries;
+	};
+
+	struct match_s {
+		int entry;          // index into the entries, -1: unknown firmware
+		int closest;        // the last remaining candidate of an unknown firmware, -1: none
+		int probes;         // hardware CRCs of the identification
+		int confirmed;
+		int confirmRanges;
+	};
+
+	void build(std::string index, catalogue_s &catalogue);
+	void save(std::string filename, catalogue_s &catalogue);
+	void load(std::string filename, catalogue_s &catalogue);
+
+	match_s identify(isp::session *session, catalogue_s &catalogue);
+	void print(catalogue_s &catalogue, match_s &match);
+
+};
@@ -0,0 +1,329 @@
+#include <plog/Log.h>
+#include <CRC.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include "delta.h"
+
+using namespace delta;
+
+// Equal runs shorter than this are cheaper as extra bytes than as a new control triplet
+const uint32_t MIN_COPY = 16;
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+	for (int i = 0; i < 4; i++) out.push_back(v >> (8 * i));
+}
+
+static uint32_t get32(const std::vector<uint8_t> &in, size_t &pos) {
+	if (pos + 4 > in.size()) throw delta::exception("Truncated patch");
+	uint32_t v = in[pos] | (in[pos + 1] << 8) | (in[pos + 2] << 16) | ((uint32_t)in[pos + 3] << 24);
+	pos += 4;
+	return v;
+}
+
+void delta::readImage(std::string filename, std::vector<uint8_t> &image) {
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) throw delta::exception("Unable to open the image: " + filename);
+
+	uint8_t buffer[4096];
+	size_t readed;
+	image.clear();
+	while ((readed = fread(buffer, 1, sizeof(buffer), fp)) > 0) image.insert(image.end(), buffer, buffer + readed);
+	fclose(fp);
+}
+
+void delta::create(const std::vector<uint8_t> &base, const std::vector<uint8_t> &target, uint32_t blockSize, patch_s &patch) {
+	patch.blockSize = blockSize;
+	patch.baseSize = base.size();
+	patch.baseCRC = base.empty() ? 0 : CRC::Calculate(&base[0], base.size(), CRC::CRC_32());
+	patch.targetSize = target.size();
+	patch.targetCRC = target.empty() ? 0 : CRC::Calculate(&target[0], target.size(), CRC::CRC_32());
+	patch.targetCRC8 = target.empty() ? 0 : CRC::Calculate(&target[0], target.size(), CRC::CRC_8());
+
+	// Fingerprint of the base, block by block, the device must match all of them
+	patch.baseBlockCRC.clear();
+	for (uint32_t offset = 0; offset < base.size(); offset += blockSize) {
+		uint32_t size = blockSize;
+		if (offset + size > base.size()) size = base.size() - offset;
+		patch.baseBlockCRC.push_back(CRC::Calculate(&base[offset], size, CRC::CRC_8()));
+	}
+
+	// Changed blocks of the target range
+	patch.changedBlocks.clear();
+	for (uint32_t offset = 0; offset < target.size(); offset += blockSize) {
+		uint32_t end = offset + blockSize;
+		if (end > target.size()) end = target.size();
+
+		for (uint32_t i = offset; i < end; i++) {
+			if (i >= base.size() || base[i] != target[i]) {
+				patch.changedBlocks.push_back(offset / blockSize);
+				break;
+			}
+		}
+	}
+
+	// Controls: the images share the layout, so the copies are aligned (the base position
+	// always follows the target position) and every difference goes into the extra bytes
+	patch.controls.clear();
+	patch.extra.clear();
+
+	uint32_t pos = 0;
+	while (pos < target.size()) {
+		uint32_t copy = 0;
+		while (pos + copy < target.size() && pos + copy < base.size() && base[pos + copy] == target[pos + copy]) copy++;
+
+		uint32_t extraStart = pos + copy;
+		uint32_t extraEnd = extraStart;
+		while (extraEnd < target.size()) {
+			uint32_t equal = 0;
+			while (equal < MIN_COPY && extraEnd + equal < target.size() && extraEnd + equal < base.size()
+				&& base[extraEnd + equal] == target[extraEnd + equal]) equal++;
+			if (equal == MIN_COPY || extraEnd + equal == target.size()) break;
+			extraEnd += equal + 1;
+		}
+
+		control_s control;
+		control.copyLength = copy;
+		control.extraLength = extraEnd - extraStart;
+		control.seek = control.extraLength;
+		control.extraOffset = patch.extra.size();
+		patch.extra.insert(patch.extra.end(), target.begin() + extraStart, target.begin() + extraEnd);
+		patch.controls.push_back(control);
+
+		pos = extraEnd;
+	}
+
+	PLOG_INFO << "Patch created (" << std::dec << patch.changedBlocks.size() << " changed block(s), "
+		<< patch.controls.size() << " control(s), " << patch.extra.size() << " extra byte)";
+}
+
+void delta::save(std::string filename, patch_s &patch) {
+	std::vector<uint8_t> out;
+
+	out.push_back('O'); out.push_back('D'); out.push_back('C'); out.push_back('D');
+	out.push_back(VERSION); out.push_back(VERSION >> 8); out.push_back(0); out.push_back(0);
+	put32(out, patch.blockSize);
+	put32(out, patch.baseSize);
+	put32(out, patch.baseCRC);
+	put32(out, patch.targetSize);
+	put32(out, patch.targetCRC);
+	out.push_back(patch.targetCRC8); out.push_back(0); out.push_back(0); out.push_back(0);
+
+	put32(out, patch.baseBlockCRC.size());
+	out.insert(out.end(), patch.baseBlockCRC.begin(), patch.baseBlockCRC.end());
+
+	put32(out, patch.changedBlocks.size());
+	for (size_t i = 0; i < patch.changedBlocks.size(); i++) put32(out, patch.changedBlocks[i]);
+
+	put32(out, patch.controls.size());
+	for (size_t i = 0; i < patch.controls.size(); i++) {
+		control_s &control = patch.controls[i];
+		put32(out, control.copyLength);
+		put32(out, control.extraLength);
+		put32(out, control.seek);
+		out.insert(out.end(), patch.extra.begin() + control.extraOffset, patch.extra.begin() + control.extraOffset + control.extraLength);
+	}
+
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (fp == NULL) throw delta::exception("Unable to open the patch file: " + filename);
+	size_t written = fwrite(&out[0], 1, out.size(), fp);
+	fclose(fp);
+	if (written != out.size()) throw delta::exception("Unable to write the patch file: " + filename);
+
+	PLOG_INFO << "Patch saved: " << filename << " (" << std::dec << out.size() << " byte)";
+}
+
+void delta::load(std::string filename, patch_s &patch) {
+	std::vector<uint8_t> in;
+	readImage(filename, in);
+
+	if (in.size() < 32 || memcmp(&in[0], "ODCD", 4) != 0) throw delta::exception("Not a patch file: " + filename);
+	if ((in[4] | (in[5] << 8)) != VERSION) throw delta::exception("Unsupported patch version: " + filename);
+
+	size_t pos = 8;
+	patch.blockSize = get32(in, pos);
+	patch.baseSize = get32(in, pos);
+	patch.baseCRC = get32(in, pos);
+	patch.targetSize = get32(in, pos);
+	patch.targetCRC = get32(in, pos);
+	patch.targetCRC8 = in[pos];
+	pos += 4;
+
+	if (patch.blockSize == 0) throw delta::exception("Invalid patch block size");
+
+	uint32_t count = get32(in, pos);
+	if (pos + count > in.size()) throw delta::exception("Truncated patch");
+	patch.baseBlockCRC.assign(in.begin() + pos, in.begin() + pos + count);
+	pos += count;
+
+	count = get32(in, pos);
+	patch.changedBlocks.clear();
+	for (uint32_t i = 0; i < count; i++) patch.changedBlocks.push_back(get32(in, pos));
+
+	count = get32(in, pos);
+	patch.controls.clear();
+	patch.extra.clear();
+	uint64_t targetPos = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		control_s control;
+		control.copyLength = get32(in, pos);
+		control.extraLength = get32(in, pos);
+		control.seek = (int32_t)get32(in, pos);
+		control.extraOffset = patch.extra.size();
+
+		if (pos + control.extraLength > in.size()) throw delta::exception("Truncated patch");
+		patch.extra.insert(patch.extra.end(), in.begin() + pos, in.begin() + pos + control.extraLength);
+		pos += control.extraLength;
+
+		targetPos += (uint64_t)control.copyLength + control.extraLength;
+		patch.controls.push_back(control);
+	}
+
+	if (targetPos != patch.targetSize) throw delta::exception("The patch controls don't cover the target image");
+}
+
+// A copy may read from its own block, from an untouched block or from an affected block rewritten after it
+static void checkCopies(patch_s &patch, std::set<uint32_t> &affected, uint32_t eraseSize) {
+	uint64_t targetPos = 0;
+	int64_t basePos = 0;
+
+	for (size_t i = 0; i < patch.controls.size(); i++) {
+		control_s &control = patch.controls[i];
+
+		// Pieces which stay in one target and one source block
+		for (uint32_t done = 0; done < control.copyLength;) {
+			uint64_t target = targetPos + done;
+			int64_t source = basePos + done;
+			if (source < 0) throw delta::exception("The patch copies from before the flash");
+
+			uint32_t piece = std::min((uint64_t)(control.copyLength - done), eraseSize - target % eraseSize);
+			piece = std::min((uint64_t)piece, eraseSize - (uint64_t)source % eraseSize);
+
+			uint32_t targetBlock = target - target % eraseSize;
+			uint32_t sourceBlock = source - source % eraseSize;
+			if (sourceBlock < targetBlock && affected.count(targetBlock) && affected.count(sourceBlock)) {
+				std::stringstream msg;
+				msg << "The patch copies into the block at 0x" << std::hex << targetBlock << " from the already rewritten block at 0x" << sourceBlock;
+				throw delta::exception(msg.str());
+			}
+
+			done += piece;
+		}
+
+		targetPos += (uint64_t)control.copyLength + control.extraLength;
+		basePos += (int64_t)control.copyLength + control.seek;
+	}
+}
+
+void delta::apply(isp::session *session, patch_s &patch) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	if (patch.baseSize > flash->getSize() || patch.targetSize > flash->getSize()) throw delta::exception("The patch doesn't fit into the flash chip");
+
+	PLOG_INFO << "Check the device against the base image (CRC-32: " << std::hex << patch.baseCRC << ")";
+
+	for (uint32_t i = 0; i < patch.baseBlockCRC.size(); i++) {
+		uint32_t start = i * patch.blockSize;
+		uint32_t end = start + patch.blockSize;
+		if (end > patch.baseSize) end = patch.baseSize;
+
+		if (device->calculateCRC(start, end - 1) != patch.baseBlockCRC[i]) {
+			std::stringstream msg;
+			msg << "The device doesn't hold the base image of the patch (block at 0x" << std::hex << start << " differs)";
+			throw delta::exception(msg.str());
+		}
+	}
+
+	PLOG_INFO << "Base image ok";
+
+	// Erase blocks of the flash which contain a changed patch block
+	uint32_t eraseSize = flash->getBlockSize();
+	std::set<uint32_t> affected;
+	for (size_t i = 0; i < patch.changedBlocks.size(); i++) {
+		uint32_t start = patch.changedBlocks[i] * patch.blockSize;
+		uint32_t end = start + patch.blockSize;
+		if (end > patch.targetSize) end = patch.targetSize;
+		for (uint32_t address = start - start % eraseSize; address < end; address += eraseSize) affected.insert(address);
+	}
+
+	// Every block is rebuilt from the flash, so a copy can't read from an affected block rewritten before its own:
+	// the whole patch is checked before the first erase, a refused patch leaves the base image intact
+	checkCopies(patch, affected, eraseSize);
+
+	std::vector<uint8_t> original(eraseSize);
+	std::vector<uint8_t> block(eraseSize);
+
+	device->beginFlashWrite(false);
+
+	try {
+		for (std::set<uint32_t>::iterator it = affected.begin(); it != affected.end(); ++it) {
+			uint32_t blockStart = *it;
+			uint32_t blockEnd = blockStart + eraseSize;
+
+			// Current content first: the bytes outside of the target range stay as they are
+			device->readFlashContent(&original[0], blockStart, eraseSize);
+			block = original;
+
+			// Walk the controls and rebuild the target bytes of this block
+			uint64_t targetPos = 0;
+			int64_t basePos = 0;
+			for (size_t i = 0; i < patch.controls.size() && targetPos < blockEnd; i++) {
+				control_s &control = patch.controls[i];
+
+				// The part of the copy inside this block, its source is taken from the original content
+				// or read from the flash in one call per run outside of the block
+				uint64_t from = std::max(targetPos, (uint64_t)blockStart);
+				uint64_t to = std::min(targetPos + control.copyLength, (uint64_t)blockEnd);
+				for (uint64_t pos = from; pos < to;) {
+					int64_t source = basePos + (int64_t)(pos - targetPos);
+					uint32_t length;
+
+					if (source >= blockStart && source < blockEnd) {
+						length = std::min(to - pos, (uint64_t)(blockEnd - source));
+						memcpy(&block[pos - blockStart], &original[source - blockStart], length);
+					} else {
+						length = (source < blockStart) ? std::min(to - pos, (uint64_t)(blockStart - source)) : to - pos;
+						device->readFlashContent(&block[pos - blockStart], source, length);
+					}
+
+					pos += length;
+				}
+				targetPos += control.copyLength;
+				basePos += control.copyLength;
+
+				for (uint32_t j = 0; j < control.extraLength; j++, targetPos++) {
+					if (targetPos < blockStart || targetPos >= blockEnd) continue;
+					block[targetPos - blockStart] = patch.extra[control.extraOffset + j];
+				}
+
+				basePos += control.seek;
+			}
+
+			if (block == original) {
+				PLOG_INFO << "Block at 0x" << std::hex << blockStart << " is already up to date";
+				continue;
+			}
+
+			device->eraseFlashBlock(blockStart);
+			device->programFlashContent(&block[0], blockStart, eraseSize, true);
+			device->verifyFlashContent(&block[0], blockStart, eraseSize);
+		}
+	} catch (...) {
+		// The protection is restored even if the patch failed halfway
+		try {
+			device->endFlashWrite();
+		} catch (...) {}
+		throw;
+	}
+
+	device->endFlashWrite();
+
+	PLOG_INFO << "Patch applied on " << std::dec << affected.size() << " block(s), check the whole target image";
+
+	if (patch.targetSize > 0 && device->calculateCRC(0, patch.targetSize - 1) != patch.targetCRC8) throw delta::exception("Target image CRC mismatch");
+
+	PLOG_INFO << "CRC ok";
+}
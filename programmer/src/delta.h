@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+
+namespace delta {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Binary patch between two firmware images (little endian)
+
+		header:   "ODCD" / uint16 version / uint16 reserved / uint32 block size
+		          uint32 base size / uint32 base CRC-32 / uint32 target size / uint32 target CRC-32
+		          uint8 target CRC-8 / 3 byte reserved
+		base:     uint32 block count / uint8 CRC-8 of every base block (the device fingerprint)
+		changed:  uint32 count / uint32 block index (ascending)
+		controls: uint32 count / bsdiff style triplets, each followed by its extra bytes:
+		          uint32 copy length (copied from the base) / uint32 extra length / int32 base seek
+	*/
+
+	const uint16_t VERSION = 1;
+	const uint32_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+	struct control_s {
+		uint32_t copyLength;
+		uint32_t extraLength;
+		int32_t seek;
+		uint32_t extraOffset; // into patch_s::extra
+	};
+
+	struct patch_s {
+		uint32_t blockSize;
+		uint32_t baseSize;
+		uint32_t baseCRC;
+		uint32_t targetSize;
+		uint32_t targetCRC;
+		uint8_t targetCRC8;
+
+		std::vector<uint8_t> baseBlockCRC;
+		std::vector<uint32_t> changedBlocks;
+		std::vector<control_s> controls;
+		std::vector<uint8_t> extra;
+	};
+
+	void readImage(std::string filename, std::vector<uint8_t> &image);
+
+	void create(const std::vector<uint8_t> &base, const std::vector<uint8_t> &target, uint32_t blockSize, patch_s &patch);
+	void save(std::string filename, patch_s &patch);
+	void load(std::string filename, patch_s &patch);
+
+	// Checks the device against the base fingerprints, then rewrites only the erase blocks which change
+	void apply(isp::session *session, patch_s &patch);
+
+};
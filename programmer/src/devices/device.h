@@ -23,15 +23,32 @@ namespace devices {
 				if (!connection->isOpened()) throw new devices::exception("Unable to use closed i2c connection");
 				this->i2cc = connection;
 			};
-			~device() {};
+			virtual ~device() {};
 			virtual void enterISPMode() = 0;
 			virtual bool isInISPMode() = 0;
 			virtual void exitISPMode() = 0;
 
+			virtual uint8_t calculateCRC(uint32_t startAddress, uint32_t endAddress) = 0;
+
 			virtual uint32_t getFlashJedecID() = 0;
 			virtual void setFlashDevice(flash::device *flash) = 0;
+			virtual void probeTransferSize() = 0;
+			virtual size_t readFlashData(uint8_t *buffer, uint32_t startAddress, size_t size) = 0; // without the CRC check
 			virtual size_t readFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) = 0;
 			virtual void writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) = 0;
+
+			// Building blocks of writeFlashContent, for callers who stream the image window by window
+			virtual bool beginFlashWrite(bool eraseChip) = 0; // returns true if the chip is erased
+			virtual void eraseFlashBlock(uint32_t address) = 0;
+			virtual void eraseFlashSector(uint32_t address) = 0; // flash::device::getSectorSize() byte
+			virtual void programFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size, bool skipBlank) = 0;
+			virtual void endFlashWrite() = 0;
+			virtual void verifyFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) = 0;
+
+			// Upload of the next page while the previous one is programming, where the controller allows it
+			// Off by default: only after a bench run passed on the controller, or on an explicit request
+			virtual void setProgramPipeline(bool enabled) = 0;
+			virtual bool hasProgramPipeline() = 0; // true once an overlapped page passed its check
 	};
 
 };
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../i2c.h"
+
+namespace devices {
+
+	// Compile-time register descriptions: everything below folds into constants
+
+	namespace regmap {
+
+		template <uint8_t Address> struct reg {
+			enum : uint8_t { address = Address };
+		};
+
+		// 'Width' bit wide field of a register from bit 'Offset'
+		template <typename Reg, unsigned Offset, unsigned Width = 1> struct field {
+			typedef Reg reg;
+
+			enum : uint8_t {
+				offset = Offset,
+				mask = ((1u << Width) - 1) << Offset
+			};
+
+			static constexpr uint8_t value(uint8_t v) {return (v << Offset) & mask;};
+			static constexpr uint8_t get(uint8_t r) {return (r & mask) >> Offset;};
+			static constexpr uint8_t set(uint8_t r, uint8_t v) {return (r & ~mask) | value(v);};
+			static constexpr bool check(uint8_t r) {return (r & mask) != 0;};
+		};
+
+		// Ready-to-send register writes, the first 'count' ones are used
+		template <size_t N> struct batch {
+			i2c::write_s writes[N];
+			size_t count;
+		};
+
+		template <typename Reg> constexpr i2c::write_s write(uint8_t data) {
+			return i2c::write_s{Reg::address, data};
+		}
+
+		// Placeholder of the unused tail of a batch
+		constexpr i2c::write_s none() {
+			return i2c::write_s{0, 0};
+		}
+
+	};
+
+};
@@ -1,16 +1,24 @@
 #include <plog/Log.h>
 #include <CRC.h>
 #include "rtd2660.h"
-#include "../bits.h"
+#include "../probes.h"
+#include <string.h>
+#include <time.h>
+#include <sstream>
 
 using namespace devices;
 
-rtd2660::rtd2660(i2c::connection *connection): device::device(connection) {
+template <typename Map> rtd266x<Map>::rtd266x(i2c::connection *connection): device::device(connection) {
 	PLOG_DEBUG << "Device created with connection " << connection;
 	this->flash = NULL;
+	this->bank = -1;
+	this->readWindow = RTD2660::READ_WINDOW_MAX;
+	this->readStreak = 0;
+	this->pipelineEnabled = false;
+	this->pipeline = -1;
 }
 
-void rtd2660::enterISPMode() {
+template <typename Map> void rtd266x<Map>::enterISPMode() {
 	PLOG_DEBUG << "Entering ISP mode";
 
 	if (this->isInISPMode()) {
@@ -18,9 +26,8 @@ void rtd2660::enterISPMode() {
 		return;
 	}
 
-	uint8_t reg_value = 0;
-	BIT_SET(reg_value, RTD2660::bf_program_instruction::isp_en);
-	this->i2cc->write(RTD2660::registers::program_instruction, reg_value);
+	static constexpr regmap::batch<1> enter = {{regmap::write<typename Map::program_instruction>(Map::isp_en::mask)}, 1};
+	this->send(enter);
 
 	if (!this->isInISPMode()) {
 		throw devices::exception("Unable to enter ISP mode");
@@ -29,12 +36,12 @@ void rtd2660::enterISPMode() {
 	PLOG_INFO << "Device entered to ISP mode";
 }
 
-bool rtd2660::isInISPMode() {
-	uint8_t reg_value = this->i2cc->read(RTD2660::registers::program_instruction);
-	return BIT_CHECK(reg_value, RTD2660::bf_program_instruction::isp_en);
+template <typename Map> bool rtd266x<Map>::isInISPMode() {
+	uint8_t reg_value = this->i2cc->read(Map::program_instruction::address);
+	return Map::isp_en::check(reg_value);
 }
 
-void rtd2660::exitISPMode() {
+template <typename Map> void rtd266x<Map>::exitISPMode() {
 	PLOG_DEBUG << "Exiting from ISP mode";
 
 	if (!this->isInISPMode()) {
@@ -42,8 +49,8 @@ void rtd2660::exitISPMode() {
 		return;
 	}
 
-	uint8_t data = 0;
-	this->i2cc->write(RTD2660::registers::program_instruction, data);
+	static constexpr regmap::batch<1> exit = {{regmap::write<typename Map::program_instruction>(0)}, 1};
+	this->send(exit);
 
 	if (this->isInISPMode()) {
 		throw devices::exception("Unable to exit from ISP mode");
@@ -52,176 +59,220 @@ void rtd2660::exitISPMode() {
 	PLOG_INFO << "Device exited from ISP mode";
 }
 
-void rtd2660::scalerSendAddress(uint8_t address, bool autoIncrement) {
-	uint8_t reg_value = 0x00;
+template <typename Map> void rtd266x<Map>::scalerSendAddress(uint8_t address, bool autoIncrement) {
+	// addr_non_inc / 0: address auto inc / 1: turn-off address auto inc
+	uint8_t control = autoIncrement ? 0x00 : Map::addr_non_inc::mask;
 
-	// BIT 5 / 0: address auto inc / 1: turn-off address auto inc
-	if (autoIncrement) BIT_CLEAR(reg_value, RTD2660::bf_SCA_INF_CONTROL::addr_non_inc);
-	else BIT_SET(reg_value, RTD2660::bf_SCA_INF_CONTROL::addr_non_inc);
+	PLOG_VERBOSE << "Set SCA_INF_CONTROL: " << std::hex << std::setfill('0') << std::setw(2) << (int)control
+		<< " / SCA_INF_ADDR: " << std::setw(2) << (int)address;
 
-	PLOG_VERBOSE << "Set SCA_INF_CONTROL: " << std::hex << std::setfill('0') << std::setw(2) << (int)reg_value;
-	this->i2cc->write(RTD2660::registers::SCA_INF_CONTROL, reg_value);
-
-	PLOG_VERBOSE << "Set SCA_INF_ADDR: " << std::hex << std::setfill('0') << std::setw(2) << (int)reg_value;
-	this->i2cc->write(RTD2660::registers::SCA_INF_ADDR, address);
+	regmap::batch<2> select = {{
+		regmap::write<typename Map::SCA_INF_CONTROL>(control),
+		regmap::write<typename Map::SCA_INF_ADDR>(address)
+	}, 2};
+	this->send(select);
 }
 
-void rtd2660::scalerRead(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement) {
-	this->scalerSendAddress(address, autoIncrement);
-	for (int i = 0; i < size; i++) {
-		buffer[i] = this->i2cc->read(RTD2660::registers::SCA_INF_DATA);
+// The data port moves on with every byte, so a failed access is repeated from the address setup
+
+template <typename Map> void rtd266x<Map>::scalerRead(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement) {
+	for (int attempt = 0;; attempt++) {
+		try {
+			this->scalerSendAddress(address, autoIncrement);
+			// Every byte is a read of the data port, so the whole range goes in block transfers
+			if (size == 1) buffer[0] = this->i2cc->readPort(Map::SCA_INF_DATA::address);
+			else this->i2cc->readData(Map::SCA_INF_DATA::address, buffer, size);
+			return;
+		} catch (i2c::exception& e) {
+			if (attempt >= health::RETRY_MAX) throw;
+			PLOG_WARNING << "Scaler read failed at 0x" << std::hex << std::setfill('0') << std::setw(2) << (int)address << ", retry " << std::dec << attempt + 1;
+		}
 	}
 }
 
-void rtd2660::scalerWrite(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement) {
-	this->scalerSendAddress(address, autoIncrement);
-	for (int i = 0; i < size; i++) {
-		this->i2cc->write(RTD2660::registers::SCA_INF_DATA, buffer[i]);
+template <typename Map> void rtd266x<Map>::scalerWrite(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement) {
+	for (int attempt = 0;; attempt++) {
+		try {
+			this->scalerSendAddress(address, autoIncrement);
+			if (size == 1) this->i2cc->writePort(Map::SCA_INF_DATA::address, buffer[0]);
+			else this->i2cc->writeData(Map::SCA_INF_DATA::address, buffer, size);
+			return;
+		} catch (i2c::exception& e) {
+			if (attempt >= health::RETRY_MAX) throw;
+			PLOG_WARNING << "Scaler write failed at 0x" << std::hex << std::setfill('0') << std::setw(2) << (int)address << ", retry " << std::dec << attempt + 1;
+		}
 	}
 }
 
-void rtd2660::scalerSetByte(uint8_t address, uint8_t data) {
+template <typename Map> void rtd266x<Map>::scalerSetByte(uint8_t address, uint8_t data) {
 	this->scalerWrite(address, &data, 1, true);
 }
 
-void rtd2660::scalerSetBit(uint8_t address, uint8_t opAnd, uint8_t opOr) {
+template <typename Map> void rtd266x<Map>::scalerSetBit(uint8_t address, uint8_t opAnd, uint8_t opOr) {
 	uint8_t data;
 	this->scalerRead(address, &data, 1, true);
 	data = (data & opAnd) | opOr;
 	this->scalerWrite(address, &data, 1, true);
 }
 
-uint8_t rtd2660::calculateCRC(uint32_t startAddress, uint32_t endAddress) {
-	PLOG_DEBUG << "Request CRC checksum from the flash controller";
+// CRC-8 of two joined ranges from their own CRCs: the first one is shifted through the length of the second
+static uint8_t combineCRC8(uint8_t crcA, uint8_t crcB, uint32_t lengthB) {
+	for (uint32_t i = 0; i < lengthB; i++) {
+		for (int bit = 0; bit < 8; bit++) crcA = (crcA & 0x80) ? (crcA << 1) ^ 0x07 : (crcA << 1);
+	}
+	return crcA ^ crcB;
+}
+
+template <typename Map> uint8_t rtd266x<Map>::calculateCRC(uint32_t startAddress, uint32_t endAddress) {
+	// The controller calculates inside one bank, a range across banks is joined from the per bank CRCs
+	uint32_t address = startAddress;
+	uint8_t crc = 0;
+
+	ODC_PROBE2(crc__start, startAddress, endAddress);
+
+	while (1) {
+		uint32_t end = address - address % flash::device::BANK_SIZE + flash::device::BANK_SIZE - 1;
+		if (end > endAddress) end = endAddress;
 
-	// Read the program_instruction register
-	uint8_t reg_value = this->i2cc->read(RTD2660::registers::program_instruction);
+		uint32_t bankAddress = this->SPI_selectBank(address);
+		uint8_t bankCRC = this->calculateBankCRC(bankAddress, bankAddress + (end - address));
 
-	// write start address to registers
-	this->i2cc->write(RTD2660::registers::flash_prog_isp0, startAddress >> 16);
-	this->i2cc->write(RTD2660::registers::flash_prog_isp1, startAddress >> 8);
-	this->i2cc->write(RTD2660::registers::flash_prog_isp2, startAddress);
+		crc = (address == startAddress) ? bankCRC : combineCRC8(crc, bankCRC, end - address + 1);
 
-	// write end address to registers
-	this->i2cc->write(RTD2660::registers::CRC_end_addr0, endAddress >> 16);
-	this->i2cc->write(RTD2660::registers::CRC_end_addr1, endAddress >> 8);
-	this->i2cc->write(RTD2660::registers::CRC_end_addr2, endAddress);
+		if (end == endAddress) break;
+		address = end + 1;
+	}
+
+	ODC_PROBE3(crc__done, startAddress, endAddress, crc);
 
-	// Enable the CRC 
+	return crc;
+}
+
+template <typename Map> uint8_t rtd266x<Map>::calculateBankCRC(uint32_t startAddress, uint32_t endAddress) {
+	PLOG_DEBUG << "Request CRC checksum from the flash controller";
 
-	BIT_SET(reg_value, RTD2660::bf_program_instruction::crc_start);
-	this->i2cc->write(RTD2660::registers::program_instruction, reg_value);
+	// Start and end address, then the crc_start bit (program_instruction holds only isp_en in ISP mode)
+	this->send(crcRequest(startAddress, endAddress));
 
 	PLOG_VERBOSE << "Wait for crc_done bit is setted";
 
 	while(1) {
-		reg_value = this->i2cc->read(RTD2660::registers::program_instruction);
-		if (BIT_CHECK(reg_value, RTD2660::bf_program_instruction::crc_done) == 1) break;
+		uint8_t reg_value = this->i2cc->read(Map::program_instruction::address);
+		ODC_PROBE2(wait, probes::wait_crc, reg_value);
+		if (Map::crc_done::check(reg_value)) break;
 		usleep(1000);
 	}
 
 	PLOG_VERBOSE << "CRC calculated by the controller, read out the result";
 
-	return this->i2cc->read(RTD2660::registers::CRC_result);
+	return this->i2cc->read(Map::CRC_result::address);
 }
 
-void rtd2660::SPI_waitProgOperation() {
+template <typename Map> void rtd266x<Map>::SPI_waitProgOperation() {
 	PLOG_VERBOSE << "Wait for prog_en bit clear";
 
 	uint8_t reg_value;
 
 	while(1) {
 		// Read the program_instruction register
-		reg_value = this->i2cc->read(RTD2660::registers::program_instruction);
+		reg_value = this->i2cc->read(Map::program_instruction::address);
+		ODC_PROBE2(wait, probes::wait_program, reg_value);
 		// Check the program enable bit
-		if (BIT_CHECK(reg_value, RTD2660::bf_program_instruction::prog_en) == 0) break;
+		if (!Map::prog_en::check(reg_value)) break;
 		usleep(1000);
 	}
 }
 
-void rtd2660::SPI_waitOperation() {
+template <typename Map> bool rtd266x<Map>::SPI_waitProgBuffer() {
+	PLOG_VERBOSE << "Wait for prog_buf_wr_en bit set or prog_en bit clear";
+
+	uint8_t reg_value;
+
+	while(1) {
+		reg_value = this->i2cc->read(Map::program_instruction::address);
+		ODC_PROBE2(wait, probes::wait_buffer, reg_value);
+		// The page is done, there is nothing to overlap with
+		if (!Map::prog_en::check(reg_value)) return false;
+		// The controller took the page from the SRAM, the next one can be uploaded
+		if (Map::prog_buf_wr_en::check(reg_value)) return true;
+		usleep(100);
+	}
+}
+
+template <typename Map> void rtd266x<Map>::SPI_waitOperation() {
 	PLOG_VERBOSE << "Wait for enable bit clear";
 
 	uint8_t reg_value;
 
 	while(1) {
 		// Read the Common Instruction Register
-		reg_value = this->i2cc->read(RTD2660::registers::common_inst_en);
+		reg_value = this->i2cc->read(Map::common_inst_en::address);
+		ODC_PROBE2(wait, probes::wait_operation, reg_value);
 		// Check the enable bit
-		if (BIT_CHECK(reg_value, RTD2660::bf_common_inst_en::comm_inst_en) == 0) break;
+		if (!Map::comm_inst_en::check(reg_value)) break;
 		usleep(1000);
 	}
 }
 
-size_t rtd2660::SPI_read(uint32_t address, uint8_t *data, size_t bufferSize) {
-	PLOG_VERBOSE << "Start SPI_read";
-	uint32_t ret = this->SPI_commonCommand(RTD2660::v_comm_inst::read, 0x03, 3, 3, address);
+template <typename Map> void rtd266x<Map>::SPI_waitBusy() {
+	PLOG_VERBOSE << "Wait for the WIP bit of the flash status register";
 
-	PLOG_DEBUG << "Read " << bufferSize << " byte data through SPI from 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)address;
+	int16_t rdsr = this->flash != NULL ? this->flash->getOpCode_readStatusRegister() : -1;
+	if (rdsr == -1) rdsr = 0x05;
 
-	int32_t remaining = bufferSize;
-	int32_t readed = 0;
+	while(1) {
+		// Bit 0 of the status register: Write In Progress
+		uint32_t status = this->SPI_commonCommand(RTD2660::v_comm_inst::read, rdsr, 1, 0, 0);
+		ODC_PROBE2(wait, probes::wait_busy, status);
+		if ((status & 0x01) == 0) break;
+		usleep(1000);
+	}
+}
 
-	while (remaining > 0) { // if we have remaining data
-		int32_t chunkSize = remaining;
-		if (chunkSize > 32) chunkSize = 32; // the chunk size can't be larger than 32 byte
+template <typename Map> uint32_t rtd266x<Map>::SPI_selectBank(uint32_t address) {
+	if (this->flash == NULL || this->flash->getBankCount() <= 1) return address;
 
-		uint32_t readLength = this->i2cc->readBlock(RTD2660::registers::program_data_port, data, chunkSize);
-		readed += readLength;
-		data += readLength; // move the data pointer forward
-		remaining -= readLength; // consume the remaining bytes
-	}
+	uint8_t bank = address / flash::device::BANK_SIZE;
 
-	PLOG_VERBOSE << "Read done (" << readed << " bytes readed)";
+	if (bank != this->bank) {
+		int16_t extendedAddress = this->flash->getOpCode_extendedAddress();
+		if (extendedAddress == -1) throw devices::exception("Flash chip hasnt got extended address register, only the first 16 MB is reachable");
 
-	return readed;
-}
+		PLOG_DEBUG << "Select flash bank " << std::dec << (int)bank;
 
-uint32_t rtd2660::SPI_commonCommand(RTD2660::v_comm_inst type, uint8_t opCode, uint8_t readNum, uint8_t writeNum, uint32_t writeValue) {
-	PLOG_VERBOSE << "Start SPI_commonCommand";
+		// Write Extended Address Register: the upper address byte of the 3 byte commands
+		this->SPI_commonCommand(RTD2660::v_comm_inst::write_after_WREN, extendedAddress, 0, 1, bank);
+		this->bank = bank;
+	}
 
-	// Clamp values
-	readNum &= 0b11;  // 2 bit
-	writeNum &= 0b11; // 2 bit
-	writeValue &= 0xFFFFFF; // 16 bit
+	return address % flash::device::BANK_SIZE;
+}
 
-	// Set the register value, without the enable bit
+template <typename Map> size_t rtd266x<Map>::SPI_read(uint32_t address, uint8_t *data, size_t bufferSize) {
+	PLOG_VERBOSE << "Start SPI_read";
+	uint32_t ret = this->SPI_commonCommand(RTD2660::v_comm_inst::read, 0x03, 3, 3, address);
 
-	uint8_t reg_value =
-		(type << RTD2660::bf_common_inst_en::comm_inst)
-		| (writeNum << RTD2660::bf_common_inst_en::write_num)
-		| (readNum << RTD2660::bf_common_inst_en::read_num);
+	PLOG_DEBUG << "Read " << bufferSize << " byte data through SPI from 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)address;
 
-	PLOG_VERBOSE << "Write the Common Instruction Register";
-	this->i2cc->write(RTD2660::registers::common_inst_en, reg_value);
+	// the connection splits the data into transfers (32 byte with SMBus, larger with plain i2c)
+	size_t readed = this->i2cc->readData(Map::program_data_port::address, data, bufferSize);
 
-	// write cmd op code
-	PLOG_VERBOSE << "Write cmd op code";
-	this->i2cc->write(RTD2660::registers::common_op_code, opCode);
+	PLOG_VERBOSE << "Read done (" << readed << " bytes readed)";
 
-	// write bytes to ISP
-	PLOG_VERBOSE << "Write bytes to ISP";
+	return readed;
+}
 
-	switch (writeNum) {
-		case 0: break; // No write
-		case 1: // Write 1 byte
-			this->i2cc->write(RTD2660::registers::flash_prog_isp0, writeValue);
-			break;
-		case 2: // Write 2 bytes
-			this->i2cc->write(RTD2660::registers::flash_prog_isp0, writeValue >> 8);
-			this->i2cc->write(RTD2660::registers::flash_prog_isp1, writeValue);
-			break;
-		case 3: // Write 3 bytes
-			this->i2cc->write(RTD2660::registers::flash_prog_isp0, writeValue >> 16);
-			this->i2cc->write(RTD2660::registers::flash_prog_isp1, writeValue >> 8);
-			this->i2cc->write(RTD2660::registers::flash_prog_isp2, writeValue);
-			break;
-	}
+template <typename Map> uint32_t rtd266x<Map>::SPI_commonCommand(RTD2660::v_comm_inst type, uint8_t opCode, uint8_t readNum, uint8_t writeNum, uint32_t writeValue) {
+	PLOG_VERBOSE << "Start SPI_commonCommand";
+	return this->runCommand(command(type, opCode, readNum, writeNum, writeValue), readNum & 0b11);
+}
 
-	PLOG_VERBOSE << "Set the enable bit on the Common Instruction Register";
+template <typename Map> uint32_t rtd266x<Map>::runCommand(const command_t &cmd, uint8_t readNum) {
+	// The opcode is the second write of every command
+	ODC_PROBE2(command__start, cmd.writes[1].data, readNum);
 
-	BIT_SET(reg_value, RTD2660::bf_common_inst_en::comm_inst_en);
-	this->i2cc->write(RTD2660::registers::common_inst_en, reg_value);
+	// Instruction register, opcode, ISP bytes and the enable bit in one batch
+	this->send(cmd);
 
 	// Enable bit cleared when the MCU finished the operation on the flash device
 	this->SPI_waitOperation();
@@ -234,31 +285,102 @@ uint32_t rtd2660::SPI_commonCommand(RTD2660::v_comm_inst type, uint8_t opCode, u
 
 	switch (readNum) {
 		case 1:
-			retValue = this->i2cc->read(RTD2660::registers::common_inst_read_port0);
+			retValue = this->i2cc->read(Map::common_inst_read_port0::address);
 			break;
 		case 2:
 			retValue =
-				(this->i2cc->read(RTD2660::registers::common_inst_read_port0) << 8)
-				| this->i2cc->read(RTD2660::registers::common_inst_read_port1);
+				(this->i2cc->read(Map::common_inst_read_port0::address) << 8)
+				| this->i2cc->read(Map::common_inst_read_port1::address);
 			break;
 		case 3:
 			retValue =
-				(this->i2cc->read(RTD2660::registers::common_inst_read_port0) << 16)
-				| (this->i2cc->read(RTD2660::registers::common_inst_read_port1) << 8)
-				| this->i2cc->read(RTD2660::registers::common_inst_read_port2);
+				(this->i2cc->read(Map::common_inst_read_port0::address) << 16)
+				| (this->i2cc->read(Map::common_inst_read_port1::address) << 8)
+				| this->i2cc->read(Map::common_inst_read_port2::address);
 			break;
 	}
 
+	ODC_PROBE2(command__done, cmd.writes[1].data, retValue);
+
 	return retValue;
 }
 
-uint32_t rtd2660::getFlashJedecID() {
-	uint32_t jedecId = this->SPI_commonCommand(RTD2660::v_comm_inst::read, 0x9f, 3, 0, 0);
+template <typename Map> void rtd266x<Map>::probeTransferSize() {
+	PLOG_DEBUG << "Probe the largest data transfer of the adapter";
+
+	this->i2cc->setMaxTransferSize(i2c::SMBUS_BLOCK_MAX);
+
+	if (!this->i2cc->hasRawSupport()) {
+		PLOG_INFO << "The i2c adapter supports SMBus only, using " << i2c::SMBUS_BLOCK_MAX << " byte transfers";
+		return;
+	}
+
+	// Reference content through SMBus, the probes must read back the same bytes
+	// (the controller must keep incrementing the SPI address across a long transfer)
+	uint8_t reference[i2c::RAW_TRANSFER_MAX];
+	uint8_t probe[i2c::RAW_TRANSFER_MAX];
+
+	this->SPI_read(0, reference, sizeof(reference));
+
+	// Per-transfer overhead on the wire: address+W, register, (repeated start) address+R
+	const int readOverhead = 3;
+	const int writeOverhead = 2;
+
+	size_t best = i2c::SMBUS_BLOCK_MAX;
+
+	for (size_t size = i2c::RAW_TRANSFER_MAX; size > i2c::SMBUS_BLOCK_MAX; size /= 2) {
+		this->SPI_commonCommand(RTD2660::v_comm_inst::read, 0x03, 3, 3, 0);
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		bool accepted;
+		try {
+			accepted = this->i2cc->readRaw(Map::program_data_port::address, probe, size);
+		} catch (i2c::exception& e) {
+			accepted = false;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (!accepted) {
+			PLOG_DEBUG << "Transfer size " << std::dec << size << " byte: refused";
+			continue;
+		}
+		if (memcmp(reference, probe, size) != 0) {
+			PLOG_DEBUG << "Transfer size " << std::dec << size << " byte: data mismatch";
+			continue;
+		}
+
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		PLOG_DEBUG << "Transfer size " << std::dec << size << " byte: accepted (" << (int)(size / seconds / 1024) << " kb/s)";
+
+		best = size;
+		break;
+	}
+
+	// Only the reads are sized here: the probe can't write without programming the flash,
+	// the page writes stay at the SMBus block size (see i2c::connection::setMaxWriteSize)
+	this->i2cc->setMaxTransferSize(best);
+
+	// Report the payload efficiency for each transfer size up to the selected one
+	for (size_t size = i2c::SMBUS_BLOCK_MAX; size <= best; size *= 2) {
+		PLOG_INFO << "Transfer size " << std::dec << std::setw(4) << size << " byte: payload efficiency "
+			<< (int)(100.0 * size / (size + readOverhead)) << "% read / "
+			<< (int)(100.0 * size / (size + writeOverhead)) << "% write, "
+			<< (this->flash != NULL ? (this->flash->getPageSize() + size - 1) / size : 0) << " transfer(s) per page"
+			<< (size == best ? " <- selected for the reads" : "");
+	}
+}
+
+template <typename Map> uint32_t rtd266x<Map>::getFlashJedecID() {
+	static constexpr command_t readJedecId = command(RTD2660::v_comm_inst::read, flash::standardRegisters::JEDECID, 3, 0, 0);
+	uint32_t jedecId = this->runCommand(readJedecId, 3);
 	PLOG_DEBUG << "Flash device Jedec ID: "  << std::hex << jedecId;
 	return jedecId;
 }
 
-void rtd2660::setupFlashOpCodes() {
+template <typename Map> void rtd266x<Map>::setupFlashOpCodes() {
 	if (this->flash == NULL) return;
 	int16_t wren = this->flash->getOpCode_writeEnable();
 	int16_t ewsr = this->flash->getOpCode_writeRegister();
@@ -267,76 +389,127 @@ void rtd2660::setupFlashOpCodes() {
 	int16_t program = this->flash->getOpCode_program();
 	int16_t read_status_register = this->flash->getOpCode_readStatusRegister();
 
-	if (wren != -1) this->i2cc->write(RTD2660::registers::wren_op_code, wren);
+	// The opcode registers are known at compile time, only the opcodes come from the flash table
+	regmap::batch<6> setup;
+	setup.count = 0;
+
+	if (wren != -1) setup.writes[setup.count++] = regmap::write<typename Map::wren_op_code>(wren);
 	else PLOG_WARNING << "No flash opcode for wren";
 
-	if (ewsr != -1) this->i2cc->write(RTD2660::registers::ewsr_op_code, ewsr);
+	if (ewsr != -1) setup.writes[setup.count++] = regmap::write<typename Map::ewsr_op_code>(ewsr);
 	else PLOG_WARNING << "No flash opcode for ewsr";
 
-	if (read != -1) this->i2cc->write(RTD2660::registers::read_op_code, read);
+	if (read != -1) setup.writes[setup.count++] = regmap::write<typename Map::read_op_code>(read);
 	else PLOG_WARNING << "No flash opcode for read";
 
-	if (fast_read != -1) this->i2cc->write(RTD2660::registers::fast_read_op_code, fast_read);
+	if (fast_read != -1) setup.writes[setup.count++] = regmap::write<typename Map::fast_read_op_code>(fast_read);
 	else PLOG_WARNING << "No flash opcode for fast_read";
 
-	if (program != -1) this->i2cc->write(RTD2660::registers::program_op_code, program);
+	if (program != -1) setup.writes[setup.count++] = regmap::write<typename Map::program_op_code>(program);
 	else PLOG_WARNING << "No flash opcode for program";
 
-	if (read_status_register != -1) this->i2cc->write(RTD2660::registers::read_status_register_op_code, read_status_register);
+	if (read_status_register != -1) setup.writes[setup.count++] = regmap::write<typename Map::read_status_register_op_code>(read_status_register);
 	else PLOG_WARNING << "No flash opcode for read_status_register";
+
+	this->send(setup);
 }
 
-void rtd2660::setFlashDevice(flash::device *flash) {
+template <typename Map> void rtd266x<Map>::setFlashDevice(flash::device *flash) {
+	// Leave the flash on the first bank, the controller boots from there
+	if (flash == NULL && this->bank > 0) this->SPI_selectBank(0);
+
 	this->flash = flash;
-	if (this->flash != NULL) this->setupFlashOpCodes();
+	this->bank = -1;
+	this->pipeline = -1;
+
+	if (this->flash != NULL) {
+		this->setupFlashOpCodes();
+		// The bank is unknown after a previous session, start from the first one
+		if (this->flash->getBankCount() > 1) this->SPI_selectBank(0);
+	}
 }
 
-size_t rtd2660::readFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) {
+template <typename Map> size_t rtd266x<Map>::readFlashData(uint8_t *buffer, uint32_t startAddress, size_t size) {
 	if (this->flash == NULL) throw devices::exception("Unable to read flash content without flash device setted before");
 
 	uint32_t currentAddress = startAddress;
 	uint32_t remaining = size;
 	uint32_t chunkSize;
+	int attempt = 0;
 
 	uint8_t *dataPtr = buffer;
 
 	while(1) {
 
-		// chunk size maximum is 1kb
-		if (remaining > 1024) chunkSize = 1024;
+		// chunk size is the read window (256 byte - 1kb), and a chunk stays inside one bank
+		if (remaining > this->readWindow) chunkSize = this->readWindow;
 		else chunkSize = remaining;
 
+		uint32_t bankRemaining = flash::device::BANK_SIZE - currentAddress % flash::device::BANK_SIZE;
+		if (chunkSize > bankRemaining) chunkSize = bankRemaining;
+
 		PLOG_INFO << "Read flash content - (" << chunkSize << " byte from address 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)currentAddress << ")";
 
-		uint32_t readed = this->SPI_read(currentAddress, dataPtr, chunkSize);
+		uint32_t readed;
+		try {
+			readed = this->SPI_read(this->SPI_selectBank(currentAddress), dataPtr, chunkSize);
+		} catch (i2c::exception& e) {
+			// The SPI address went on with the failed transfer: seek again with a new read command
+			if (++attempt > health::RETRY_MAX) throw;
+
+			if (this->readWindow > RTD2660::READ_WINDOW_MIN) this->readWindow /= 2;
+			this->readStreak = 0;
+
+			PLOG_WARNING << "Flash read failed at 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)currentAddress
+				<< ", read window " << std::dec << this->readWindow << " byte, retry " << attempt;
+			continue;
+		}
+
 		if (readed == 0) throw devices::exception("Unable to read flash content / 0 byte readed");
+
+		attempt = 0;
+		if (++this->readStreak >= health::GROW_AFTER && this->readWindow < RTD2660::READ_WINDOW_MAX) {
+			this->readWindow *= 2;
+			this->readStreak = 0;
+			PLOG_DEBUG << "Read window increased to " << std::dec << this->readWindow << " byte";
+		}
+
 		dataPtr += readed; // move the data pointer
 		currentAddress += readed; // move the address forward
 		remaining -= readed; // decrease the remaining data
 		if (remaining <= 0) break;
 	}
 
-	uint32_t totalReaded = currentAddress - startAddress;
+	return currentAddress - startAddress;
+}
+
+template <typename Map> size_t rtd266x<Map>::readFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) {
+	size_t totalReaded = this->readFlashData(buffer, startAddress, size);
 
 	PLOG_INFO << "Flash content readed out, check CRC";
 
+	this->verifyFlashContent(buffer, startAddress, size);
+
+	return totalReaded;
+}
+
+template <typename Map> void rtd266x<Map>::verifyFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) {
+	if (this->flash == NULL) throw devices::exception("Unable to verify flash content without flash device setted before");
+
 	// Check CRC
 
 	uint8_t mcuCRC = this->calculateCRC(startAddress, startAddress + size - 1);
 	uint8_t localCRC = CRC::Calculate(buffer, size, CRC::CRC_8());
 
-
 	PLOG_DEBUG << "MCU CRC: " << std::setfill('0') << std::setw(2) << std::hex << (int)mcuCRC;
 	PLOG_DEBUG << "Generated CRC: " << std::setfill('0') << std::setw(2) << std::hex << (int)localCRC;
 
 	if (mcuCRC != localCRC) throw devices::exception("Generated CRC/MCU CRC mismatch");
 
 	PLOG_INFO << "CRC ok";
-
-	return totalReaded;
 }
 
-void rtd2660::writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) {
+template <typename Map> bool rtd266x<Map>::beginFlashWrite(bool eraseChip) {
 	if (this->flash == NULL) throw devices::exception("Unable to write flash content without flash device setted before");
 
 	// check erase support
@@ -347,34 +520,143 @@ void rtd2660::writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t s
 
 	if (this->flash->getOpCode_writeRegister() != -1) {
 		// Unprotect the status register - EWSR (Enable Write Status Register)
-		this->SPI_commonCommand(RTD2660::v_comm_inst::write_after_EWSR, 0x01, 0, 1, 0x00);
+		static constexpr command_t unprotectStatus = command(RTD2660::v_comm_inst::write_after_EWSR, 0x01, 0, 1, 0x00);
+		this->runCommand(unprotectStatus, 0);
 	} else PLOG_WARNING << "Flash chip hasnt got EWSR register, write may be faulty";
 
 	// Unprotect the flash - WREN (WRite ENable)
-	this->SPI_commonCommand(RTD2660::v_comm_inst::write_after_WREN, 0x01, 0, 1, 0x00);
+	static constexpr command_t unprotectFlash = command(RTD2660::v_comm_inst::write_after_WREN, 0x01, 0, 1, 0x00);
+	this->runCommand(unprotectFlash, 0);
+
+	if (!eraseChip) return false;
 
 	if (hasEraseSupport) {
 		// Erase chip content
 		PLOG_INFO << "Erasing flash content";
-		this->SPI_commonCommand(RTD2660::v_comm_inst::erase, 0xc7, 0, 0, 0x00); // Read 0xC7 from flash SHER
+		ODC_PROBE2(erase__start, 0, this->flash->getSize());
+		static constexpr command_t eraseChipCommand = command(RTD2660::v_comm_inst::erase, 0xc7, 0, 0, 0x00); // Read 0xC7 from flash SHER
+		this->runCommand(eraseChipCommand, 0);
 		this->SPI_waitProgOperation();
+		ODC_PROBE2(erase__done, 0, this->flash->getSize());
 		PLOG_INFO << "Erase finished";
 	} else PLOG_WARNING << "Flash chip hasnt got chip erase support, the write process will be slower";
 
+	return hasEraseSupport;
+}
+
+template <typename Map> void rtd266x<Map>::eraseFlashBlock(uint32_t address) {
+	if (this->flash == NULL) throw devices::exception("Unable to erase flash content without flash device setted before");
+
+	int16_t blockErase = this->flash->getOpCode_blockErase();
+	if (blockErase == -1) throw devices::exception("Flash chip hasnt got block erase support");
+
+	address &= ~(this->flash->getBlockSize() - 1);
+
+	PLOG_INFO << "Erase flash block (" << std::dec << this->flash->getBlockSize() << " byte from address 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)address << ")";
+
+	ODC_PROBE2(erase__start, address, this->flash->getBlockSize());
+	this->SPI_commonCommand(RTD2660::v_comm_inst::erase, blockErase, 0, 3, this->SPI_selectBank(address));
+	this->SPI_waitProgOperation();
+	this->SPI_waitBusy();
+	ODC_PROBE2(erase__done, address, this->flash->getBlockSize());
+}
+
+template <typename Map> void rtd266x<Map>::eraseFlashSector(uint32_t address) {
+	if (this->flash == NULL) throw devices::exception("Unable to erase flash content without flash device setted before");
+
+	int16_t sectorErase = this->flash->getOpCode_sectorErase();
+	if (sectorErase == -1) {
+		// getSectorSize() is the block size on these chips
+		this->eraseFlashBlock(address);
+		return;
+	}
+
+	address &= ~(flash::device::SECTOR_SIZE - 1);
+
+	PLOG_INFO << "Erase flash sector (" << std::dec << flash::device::SECTOR_SIZE << " byte from address 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)address << ")";
+
+	ODC_PROBE2(erase__start, address, flash::device::SECTOR_SIZE);
+	this->SPI_commonCommand(RTD2660::v_comm_inst::erase, sectorErase, 0, 3, this->SPI_selectBank(address));
+	this->SPI_waitProgOperation();
+	this->SPI_waitBusy();
+	ODC_PROBE2(erase__done, address, flash::device::SECTOR_SIZE);
+}
+
+template <typename Map> void rtd266x<Map>::uploadPage(uint8_t *data, uint32_t address, uint32_t size) {
+	for (int attempt = 0;; attempt++) {
+		try {
+			// write the data length and the data address (inside the selected bank) into the registers
+			uint32_t bankAddress = this->SPI_selectBank(address);
+			this->send(programPreamble(size, bankAddress));
+
+			PLOG_VERBOSE << "Write " << size << " byte to the program data port";
+
+			// upload the data to the register, in one transfer if the adapter allows it
+			this->i2cc->writeData(Map::program_data_port::address, data, size);
+			return;
+		} catch (i2c::exception& e) {
+			// Nothing is programmed before prog_en, the page is uploaded again from its preamble
+			if (attempt >= health::RETRY_MAX) throw;
+			PLOG_WARNING << "Page upload failed at 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)address << ", retry " << std::dec << attempt + 1;
+		}
+	}
+}
+
+template <typename Map> bool rtd266x<Map>::checkPage(uint8_t *data, uint32_t address, uint32_t size) {
+	if (this->calculateCRC(address, address + size - 1) == CRC::Calculate(data, size, CRC::CRC_8())) return true;
+
+	PLOG_ERROR << "The overlapped page at 0x" << std::hex << std::setfill('0') << std::setw(6) << address << " is corrupt";
+	return false;
+}
+
+template <typename Map> void rtd266x<Map>::checkPipeline(uint8_t **data, uint32_t *address, uint32_t *size) {
+	// Both pages are checked, the log has to tell every corrupt one
+	bool programmed = this->checkPage(data[0], address[0], size[0]);
+	bool uploaded = this->checkPage(data[1], address[1], size[1]);
+
+	if (programmed && uploaded) {
+		PLOG_INFO << "Overlapped page programming works, the next pages are uploaded during the program cycles";
+		this->pipeline = 1;
+		return;
+	}
+
+	this->pipeline = 0;
+	std::stringstream msg;
+	msg << "The overlapped upload at 0x" << std::hex << std::setfill('0') << std::setw(6) << address[1] << " corrupted the flash, the pipeline is switched off (rewrite the range)";
+	throw devices::exception(msg.str());
+}
+
+template <typename Map> void rtd266x<Map>::programFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size, bool skipBlank) {
+	if (this->flash == NULL) throw devices::exception("Unable to write flash content without flash device setted before");
+
 	// Write content
 	uint8_t *dataPtr = buffer;
 	uint32_t currentAddress = startAddress;
 	uint32_t remaining = size;
 	uint32_t chunkSize;
 
+	// A page is programming (prog_en set, not waited yet)
+	bool programming = false;
+	uint8_t *programData = NULL;
+	uint32_t programAddress = 0;
+	uint32_t programSize = 0;
+	// The pages of the first overlap (the programming one and the uploaded one), checked when both are programmed
+	bool checking = false;
+	uint8_t *checkData[2] = {NULL, NULL};
+	uint32_t checkAddress[2] = {0, 0};
+	uint32_t checkSize[2] = {0, 0};
+
 	while (1) {
 		// we can write 256 byte in 1 cycle
 		if (remaining <= 0) break;
 
-		if (remaining > 256) chunkSize = 256;
+		if (remaining > RTD2660::PAGE_SIZE) chunkSize = RTD2660::PAGE_SIZE;
 		else chunkSize = remaining;
 
-		if (hasEraseSupport) { // If we has erase support, we can check the next 'chunkSize' amount of byte.
+		uint32_t bankRemaining = flash::device::BANK_SIZE - currentAddress % flash::device::BANK_SIZE;
+		if (chunkSize > bankRemaining) chunkSize = bankRemaining;
+
+		if (skipBlank) { // If the chip is erased, we can check the next 'chunkSize' amount of byte.
 			// Erase setting all of the byte to 0xFF
 			bool containsData = false;
 			// Check the dataPtr, if we have anything else than 0xFF, we need to write this chunk
@@ -397,70 +679,88 @@ void rtd2660::writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t s
 
 		PLOG_INFO << "Write flash content (" << chunkSize << " byte to address 0x" << std::hex << std::setfill('0') << std::setw(6) << (int)currentAddress << ")";
 
-		// write the data length into the register
-		this->i2cc->write(RTD2660::registers::program_length, chunkSize - 1);
-
-		// write the data adress into the registers
-		this->i2cc->write(RTD2660::registers::flash_prog_isp0, currentAddress >> 16);
-		this->i2cc->write(RTD2660::registers::flash_prog_isp1, currentAddress >> 8);
-		this->i2cc->write(RTD2660::registers::flash_prog_isp2, currentAddress);
-
-		uint32_t totalWritten = 0;
-
-		// upload the data to the register
-		while(1) {
-
-			uint8_t regChunkSize;
-			if (chunkSize > 32) regChunkSize = 32;
-			else regChunkSize = chunkSize;
+		bool uploaded = false;
+		if (programming) {
+			// Overlap the upload with the program cycle of the previous page: only in the same bank
+			// (the bank select is a flash command) and only if the controller frees the SRAM early
+			bool sameBank = this->flash->getBankCount() <= 1 || currentAddress / flash::device::BANK_SIZE == (uint32_t)this->bank;
+			if (this->pipelineEnabled && this->pipeline != 0 && !checking && sameBank && this->SPI_waitProgBuffer()) {
+				this->uploadPage(dataPtr, currentAddress, chunkSize);
+				uploaded = true;
+				if (this->pipeline == -1) {
+					checking = true;
+					checkData[0] = programData;
+					checkAddress[0] = programAddress;
+					checkSize[0] = programSize;
+					checkData[1] = dataPtr;
+					checkAddress[1] = currentAddress;
+					checkSize[1] = chunkSize;
+				}
+			}
 
-			PLOG_VERBOSE << "Write " << (int)regChunkSize << " byte to the program data port (Total chunk size: " << chunkSize << ")";
+			// wait for the write cycle of the previous page
+			this->SPI_waitProgOperation();
+			ODC_PROBE2(page__done, programAddress, programSize);
 
-			// write 32 byte each time to the register
-			this->i2cc->writeBlock(RTD2660::registers::program_data_port, dataPtr, regChunkSize);
+			// The first overlap is checked before the pipeline is trusted with the next pages
+			if (checking && !uploaded) {
+				this->checkPipeline(checkData, checkAddress, checkSize);
+				checking = false;
+			}
+		}
 
-			totalWritten += regChunkSize;
-			// move the data pointer forward
-			dataPtr += regChunkSize;
-			// consume the chunk size
-			chunkSize -= regChunkSize;
+		if (!uploaded) this->uploadPage(dataPtr, currentAddress, chunkSize);
 
-			if (chunkSize <= 0) break;
-		}
+		programData = dataPtr;
+		programAddress = currentAddress;
+		programSize = chunkSize;
 
-		remaining -= totalWritten; // consume the remaining data
-		currentAddress += totalWritten; // move the address forward
+		dataPtr += chunkSize; // move the data pointer forward
+		remaining -= chunkSize; // consume the remaining data
+		currentAddress += chunkSize; // move the address forward
 
-		// Read the program_instruction register
-		uint8_t reg_value = this->i2cc->read(RTD2660::registers::program_instruction);
-		// set the program enable bit and start the write cycle
-		BIT_SET(reg_value, RTD2660::bf_program_instruction::prog_en);
-		// write back the value with the enable bit
-		this->i2cc->write(RTD2660::registers::program_instruction, reg_value);
+		// start the write cycle: program_instruction holds only isp_en in ISP mode, no read back is needed
+		static constexpr regmap::batch<1> start = {{regmap::write<typename Map::program_instruction>(Map::isp_en::mask | Map::prog_en::mask)}, 1};
+		this->send(start);
+		ODC_PROBE3(page__start, programAddress, programSize, uploaded);
+		programming = true;
+	}
 
-		// wait for the write cycle
+	// wait for the write cycle of the last page
+	if (programming) {
 		this->SPI_waitProgOperation();
+		ODC_PROBE2(page__done, programAddress, programSize);
 	}
+	if (checking) this->checkPipeline(checkData, checkAddress, checkSize);
+}
+
+template <typename Map> void rtd266x<Map>::endFlashWrite() {
+	// Back to the first bank before the protection
+	if (this->bank > 0) this->SPI_selectBank(0);
 
 	// Protect the status register 
-	this->SPI_commonCommand(RTD2660::v_comm_inst::write_after_EWSR, 0x01, 0, 1, 0x1c);
+	static constexpr command_t protectStatus = command(RTD2660::v_comm_inst::write_after_EWSR, 0x01, 0, 1, 0x1c);
+	this->runCommand(protectStatus, 0);
 	// Protect the flash
-	this->SPI_commonCommand(RTD2660::v_comm_inst::write_after_WREN, 0x01, 0, 1, 0x1c);
+	static constexpr command_t protectFlash = command(RTD2660::v_comm_inst::write_after_WREN, 0x01, 0, 1, 0x1c);
+	this->runCommand(protectFlash, 0);
+}
 
-	PLOG_INFO << "Write finished, check CRC";
+template <typename Map> void rtd266x<Map>::writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size) {
+	bool erased = this->beginFlashWrite(true);
 
-	// Check CRC
+	// If we has erase support, the empty (0xFF) pages can be skipped
+	this->programFlashContent(buffer, startAddress, size, erased);
 
-	uint8_t mcuCRC = this->calculateCRC(startAddress, startAddress + size - 1);
-	uint8_t localCRC = CRC::Calculate(buffer, size, CRC::CRC_8());
-
-	PLOG_DEBUG << "MCU CRC: " << std::setfill('0') << std::setw(2) << std::hex << (int)mcuCRC;
-	PLOG_DEBUG << "Generated CRC: " << std::setfill('0') << std::setw(2) << std::hex << (int)localCRC;
+	this->endFlashWrite();
 
-	if (mcuCRC != localCRC) throw devices::exception("Generated CRC/MCU CRC mismatch");
+	PLOG_INFO << "Write finished, check CRC";
 
-	PLOG_INFO << "CRC ok";
+	this->verifyFlashContent(buffer, startAddress, size);
 }
 
-rtd2660::~rtd2660() {
+template <typename Map> rtd266x<Map>::~rtd266x() {
 }
+
+template class devices::rtd266x<RTD2660::map>;
+template class devices::rtd266x<RTD2662::map>;
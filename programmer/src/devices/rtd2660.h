@@ -1,6 +1,7 @@
 #pragma once
 
 #include "device.h"
+#include "registers.h"
 
 namespace devices {
 
@@ -33,6 +34,12 @@ namespace devices {
 			SCA_INF_DATA                 = 0xf5
 		};
 
+		// One read command streams at most this much through program_data_port,
+		// the window shrinks after bus errors and grows back after clean reads
+		const uint32_t READ_WINDOW_MIN = 256;
+		const uint32_t READ_WINDOW_MAX = 1024;
+		const uint32_t PAGE_SIZE = 256;
+
 		// Definitions: bf - bitfields / v - values
 
 		// registers:: common_inst_en
@@ -89,40 +96,184 @@ namespace devices {
 			reg_read_en   = 7		// Enable Read Action of Scalar Interface
 		};
 
+		// The register map of the engine: the tables above as compile-time types
+
+		struct map {
+			typedef regmap::reg<registers::common_inst_en>               common_inst_en;
+			typedef regmap::reg<registers::common_op_code>               common_op_code;
+			typedef regmap::reg<registers::wren_op_code>                 wren_op_code;
+			typedef regmap::reg<registers::ewsr_op_code>                 ewsr_op_code;
+			typedef regmap::reg<registers::flash_prog_isp0>              flash_prog_isp0;
+			typedef regmap::reg<registers::flash_prog_isp1>              flash_prog_isp1;
+			typedef regmap::reg<registers::flash_prog_isp2>              flash_prog_isp2;
+			typedef regmap::reg<registers::common_inst_read_port0>       common_inst_read_port0;
+			typedef regmap::reg<registers::common_inst_read_port1>       common_inst_read_port1;
+			typedef regmap::reg<registers::common_inst_read_port2>       common_inst_read_port2;
+			typedef regmap::reg<registers::read_op_code>                 read_op_code;
+			typedef regmap::reg<registers::fast_read_op_code>            fast_read_op_code;
+			typedef regmap::reg<registers::program_op_code>              program_op_code;
+			typedef regmap::reg<registers::read_status_register_op_code> read_status_register_op_code;
+			typedef regmap::reg<registers::program_instruction>          program_instruction;
+			typedef regmap::reg<registers::program_data_port>            program_data_port;
+			typedef regmap::reg<registers::program_length>               program_length;
+			typedef regmap::reg<registers::CRC_end_addr0>                CRC_end_addr0;
+			typedef regmap::reg<registers::CRC_end_addr1>                CRC_end_addr1;
+			typedef regmap::reg<registers::CRC_end_addr2>                CRC_end_addr2;
+			typedef regmap::reg<registers::CRC_result>                   CRC_result;
+			typedef regmap::reg<registers::SCA_INF_CONTROL>              SCA_INF_CONTROL;
+			typedef regmap::reg<registers::SCA_INF_ADDR>                 SCA_INF_ADDR;
+			typedef regmap::reg<registers::SCA_INF_DATA>                 SCA_INF_DATA;
+
+			typedef regmap::field<common_inst_en, bf_common_inst_en::comm_inst_en>  comm_inst_en;
+			typedef regmap::field<common_inst_en, bf_common_inst_en::read_num, 2>   read_num;
+			typedef regmap::field<common_inst_en, bf_common_inst_en::write_num, 2>  write_num;
+			typedef regmap::field<common_inst_en, bf_common_inst_en::comm_inst, 3>  comm_inst;
+
+			typedef regmap::field<program_instruction, bf_program_instruction::crc_done>       crc_done;
+			typedef regmap::field<program_instruction, bf_program_instruction::crc_start>      crc_start;
+			typedef regmap::field<program_instruction, bf_program_instruction::prog_buf_wr_en> prog_buf_wr_en;
+			typedef regmap::field<program_instruction, bf_program_instruction::prog_en>        prog_en;
+			typedef regmap::field<program_instruction, bf_program_instruction::isp_en>         isp_en;
+
+			typedef regmap::field<SCA_INF_CONTROL, bf_SCA_INF_CONTROL::addr_non_inc> addr_non_inc;
+		};
+
 	};
 
-	class rtd2660: public device {
+	namespace RTD2662 {
+
+		// Same ISP block as the RTD2660, a variant with other addresses or bits gets its own map
+		struct map : RTD2660::map {};
+
+	};
+
+	// One engine for the RTD266x family, the register map is resolved at compile time.
+	// Only the device interface is virtual, the register level helpers are plain calls.
+
+	template <typename Map> class rtd266x: public device {
 		private:
 			flash::device *flash;
+			int16_t bank; // selected 16 MB bank of the flash, -1: unknown
+			uint32_t readWindow;
+			int readStreak;
+			bool pipelineEnabled;
+			int8_t pipeline; // overlapped page upload / -1: not checked yet / 0: refused / 1: works
 			void setupFlashOpCodes();
+			uint8_t calculateBankCRC(uint32_t startAddress, uint32_t endAddress);
+
+			// Common instruction: the instruction register, the opcode, the written bytes (MSB first), then the enable bit
+			typedef regmap::batch<6> command_t;
+
+			static constexpr uint8_t instruction(RTD2660::v_comm_inst type, uint8_t readNum, uint8_t writeNum) {
+				return Map::comm_inst::value(type) | Map::write_num::value(writeNum) | Map::read_num::value(readNum);
+			};
+
+			static constexpr i2c::write_s ispWrite(uint8_t index, uint8_t data) {
+				return index == 0 ? regmap::write<typename Map::flash_prog_isp0>(data)
+					: index == 1 ? regmap::write<typename Map::flash_prog_isp1>(data)
+					: regmap::write<typename Map::flash_prog_isp2>(data);
+			};
+
+			static constexpr i2c::write_s commandSlot(uint8_t slot, uint8_t inst, uint8_t writeNum, uint32_t value) {
+				return slot < writeNum ? ispWrite(slot, value >> (8 * (writeNum - 1 - slot)))
+					: slot == writeNum ? regmap::write<typename Map::common_inst_en>(inst | Map::comm_inst_en::mask)
+					: regmap::none();
+			};
+
+			static constexpr command_t command(RTD2660::v_comm_inst type, uint8_t opCode, uint8_t readNum, uint8_t writeNum, uint32_t value) {
+				return command_t{{
+					regmap::write<typename Map::common_inst_en>(instruction(type, readNum & 0b11, writeNum & 0b11)),
+					regmap::write<typename Map::common_op_code>(opCode),
+					commandSlot(0, instruction(type, readNum & 0b11, writeNum & 0b11), writeNum & 0b11, value & 0xFFFFFF),
+					commandSlot(1, instruction(type, readNum & 0b11, writeNum & 0b11), writeNum & 0b11, value & 0xFFFFFF),
+					commandSlot(2, instruction(type, readNum & 0b11, writeNum & 0b11), writeNum & 0b11, value & 0xFFFFFF),
+					commandSlot(3, instruction(type, readNum & 0b11, writeNum & 0b11), writeNum & 0b11, value & 0xFFFFFF)
+				}, (size_t)3 + (writeNum & 0b11)};
+			};
+
+			// Page program preamble: length - 1 and the 24 bit address
+			static constexpr regmap::batch<4> programPreamble(uint32_t length, uint32_t address) {
+				return regmap::batch<4>{{
+					regmap::write<typename Map::program_length>(length - 1),
+					regmap::write<typename Map::flash_prog_isp0>(address >> 16),
+					regmap::write<typename Map::flash_prog_isp1>(address >> 8),
+					regmap::write<typename Map::flash_prog_isp2>(address)
+				}, 4};
+			};
+
+			// CRC range and the start bit, the ISP mode is kept on
+			static constexpr regmap::batch<7> crcRequest(uint32_t startAddress, uint32_t endAddress) {
+				return regmap::batch<7>{{
+					regmap::write<typename Map::flash_prog_isp0>(startAddress >> 16),
+					regmap::write<typename Map::flash_prog_isp1>(startAddress >> 8),
+					regmap::write<typename Map::flash_prog_isp2>(startAddress),
+					regmap::write<typename Map::CRC_end_addr0>(endAddress >> 16),
+					regmap::write<typename Map::CRC_end_addr1>(endAddress >> 8),
+					regmap::write<typename Map::CRC_end_addr2>(endAddress),
+					regmap::write<typename Map::program_instruction>(Map::isp_en::mask | Map::crc_start::mask)
+				}, 7};
+			};
+
+			template <size_t N> void send(const regmap::batch<N> &batch) {
+				this->i2cc->writeBatch(batch.writes, batch.count);
+			};
+
+			// Sends a prepared common instruction, waits for it and reads out 'readNum' result byte
+			uint32_t runCommand(const command_t &cmd, uint8_t readNum);
+
+			// Preamble and data of one page into the program SRAM, retried from the preamble
+			void uploadPage(uint8_t *data, uint32_t address, uint32_t size);
+			// CRC check of both pages of the first overlap (page N had its SRAM rewritten while it was programming),
+			// the pipeline is switched off if any of them failed
+			bool checkPage(uint8_t *data, uint32_t address, uint32_t size);
+			void checkPipeline(uint8_t **data, uint32_t *address, uint32_t *size);
 
 		public:
-			rtd2660(i2c::connection *connection);
-			~rtd2660();
+			rtd266x(i2c::connection *connection);
+			~rtd266x();
 
 			virtual void enterISPMode();
 			virtual bool isInISPMode();
 			virtual void exitISPMode();
 
-			virtual void scalerSendAddress(uint8_t address, bool autoIncrement);
-			virtual void scalerRead(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement);
-			virtual void scalerWrite(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement);
-			virtual void scalerSetByte(uint8_t address, uint8_t data);
-			virtual void scalerSetBit(uint8_t address, uint8_t opAnd, uint8_t opOr);
+			void scalerSendAddress(uint8_t address, bool autoIncrement);
+			void scalerRead(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement);
+			void scalerWrite(uint8_t address, uint8_t *buffer, size_t size, bool autoIncrement);
+			void scalerSetByte(uint8_t address, uint8_t data);
+			void scalerSetBit(uint8_t address, uint8_t opAnd, uint8_t opOr);
 
 			virtual uint8_t calculateCRC(uint32_t startAddress, uint32_t endAddress);
 
-			virtual void SPI_waitProgOperation();
-			virtual void SPI_waitOperation();
-			virtual uint32_t SPI_commonCommand(RTD2660::v_comm_inst type, uint8_t opCode, uint8_t readNum, uint8_t writeNum, uint32_t writeValue);
-			virtual size_t SPI_read(uint32_t address, uint8_t *data, size_t bufferSize);
+			void SPI_waitProgOperation();
+			bool SPI_waitProgBuffer(); // true: the SRAM is free while the page is still programming
+			void SPI_waitOperation();
+			void SPI_waitBusy();
+			uint32_t SPI_selectBank(uint32_t address); // returns the address inside the bank
+			uint32_t SPI_commonCommand(RTD2660::v_comm_inst type, uint8_t opCode, uint8_t readNum, uint8_t writeNum, uint32_t writeValue);
+			size_t SPI_read(uint32_t address, uint8_t *data, size_t bufferSize);
 
 			virtual uint32_t getFlashJedecID();
 			void setFlashDevice(flash::device *flash);
+			virtual void probeTransferSize();
 
+			virtual size_t readFlashData(uint8_t *buffer, uint32_t startAddress, size_t size);
 			virtual size_t readFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size);
 			virtual void writeFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size);
 
+			virtual bool beginFlashWrite(bool eraseChip);
+			virtual void eraseFlashBlock(uint32_t address);
+			virtual void eraseFlashSector(uint32_t address);
+			virtual void programFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size, bool skipBlank);
+			virtual void endFlashWrite();
+			virtual void verifyFlashContent(uint8_t *buffer, uint32_t startAddress, size_t size);
+
+			virtual void setProgramPipeline(bool enabled) {this->pipelineEnabled = enabled;};
+			virtual bool hasProgramPipeline() {return this->pipeline == 1;};
+
 	};
 
-};
\ No newline at end of file
+	// The members are instantiated in rtd2660.cpp for these controllers only
+	typedef rtd266x<RTD2660::map> rtd2660;
+	typedef rtd266x<RTD2662::map> rtd2662;
+
+};
@@ -0,0 +1,118 @@
+#include <plog/Log.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include "firmware.h"
+#include "stream.h"
+
+void firmware::read(isp::session *session, std::string filename, uint32_t startAddress, uint32_t size) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	uint32_t endAddress = startAddress + size;
+	if (endAddress > flash->getSize()) throw std::runtime_error("The requested range is out of the flash");
+
+	// The content is streamed out block by block, every block is CRC checked before it leaves,
+	// so only one block is buffered and "-" can be piped straight into a compressor
+	uint32_t windowSize = flash->getBlockSize();
+
+	uint8_t *buffer = (uint8_t*)malloc(windowSize);
+	if (!buffer) throw std::runtime_error("Unable to allocate memory for firmware");
+
+	try {
+		stream::file output(filename, true);
+		output.setPipeSize(windowSize);
+
+		for (uint32_t address = startAddress; address < endAddress; address += windowSize) {
+			uint32_t chunkSize = windowSize;
+			if (address + chunkSize > endAddress) chunkSize = endAddress - address;
+
+			size_t readed = device->readFlashContent(buffer, address, chunkSize);
+			if (readed != chunkSize) PLOG_WARNING << "Downloaded size is not same with the requested size (maybe the downloaded data is corrupt)";
+
+			PLOG_DEBUG << "Write downloaded block into " << output.getName();
+			output.write(buffer, readed);
+		}
+	} catch (...) {
+		free(buffer);
+		throw;
+	}
+
+	free(buffer);
+}
+
+void firmware::verify(isp::session *session, std::string filename, uint32_t startAddress) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	uint32_t windowSize = flash->getBlockSize();
+
+	uint8_t *buffer = (uint8_t*)malloc(windowSize);
+	if (buffer == NULL) throw std::runtime_error("Unable to allocate memory for firmware");
+
+	try {
+		stream::file input(filename, false);
+
+		uint32_t address = startAddress;
+		while (address < flash->getSize()) {
+			size_t readed = input.read(buffer, windowSize);
+			if (readed == 0) break;
+			if (address + readed > flash->getSize()) throw std::runtime_error("The binary is larger than the flash chip");
+
+			device->verifyFlashContent(buffer, address, readed);
+
+			address += readed;
+			if (readed < windowSize) break; // EOF
+		}
+	} catch (...) {
+		free(buffer);
+		throw;
+	}
+
+	free(buffer);
+}
+
+void firmware::download(isp::session *session, std::string filename) {
+	firmware::read(session, filename, 0, session->getFlash()->getSize());
+}
+
+void firmware::upload(isp::session *session, std::string filename) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	// Same windowing as the download: the input ("-" is stdin) is consumed block by block,
+	// programmed and CRC checked, the whole image is never held in the memory
+	uint32_t windowSize = flash->getBlockSize();
+
+	uint8_t *buffer = (uint8_t*)malloc(windowSize);
+	if (buffer == NULL) throw std::runtime_error("Unable to allocate memory for firmware");
+
+	try {
+		stream::file input(filename, false);
+
+		bool erased = device->beginFlashWrite(true);
+
+		uint32_t address = 0;
+		while (address < flash->getSize()) {
+			size_t readed = input.read(buffer, windowSize);
+			if (readed == 0) break;
+
+			// If we has erase support, the empty (0xFF) pages can be skipped
+			device->programFlashContent(buffer, address, readed, erased);
+			device->verifyFlashContent(buffer, address, readed);
+
+			address += readed;
+			if (readed < windowSize) break; // EOF
+		}
+
+		if (address >= flash->getSize() && input.read(buffer, 1) != 0) PLOG_WARNING << "The binary is larger than the flash chip, the rest is ignored";
+
+		device->endFlashWrite();
+
+		PLOG_INFO << "Write finished (" << std::dec << address << " byte)";
+	} catch (...) {
+		free(buffer);
+		throw;
+	}
+
+	free(buffer);
+}
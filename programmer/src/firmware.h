@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include "session.h"
+#include "stream.h"
+
+namespace firmware {
+
+	// Transfers between an opened ISP session and a file ("-" is stdin/stdout),
+	// the content is moved and CRC checked one flash block at a time
+
+	void read(isp::session *session, std::string filename, uint32_t startAddress, uint32_t size);
+	void verify(isp::session *session, std::string filename, uint32_t startAddress);
+
+	void download(isp::session *session, std::string filename);
+	void upload(isp::session *session, std::string filename);
+
+};
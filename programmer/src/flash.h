@@ -15,6 +15,9 @@ namespace flash {
 		int16_t program;
 		int16_t readStatusRegister;
 		int16_t chipErase;
+		int16_t blockErase;
+		int16_t sectorErase;
+		int16_t extendedAddress;
 	};
 
 	struct desc_s {
@@ -31,6 +34,9 @@ namespace flash {
 		int16_t program;
 		int16_t readStatusRegister;
 		int16_t chipErase;
+		int16_t blockErase;
+		int16_t sectorErase;
+		int16_t extendedAddress;
 	};
 
 	enum standardRegisters {
@@ -49,6 +55,7 @@ namespace flash {
 			device(uint32_t jedecId);
 			~device();
 
+			uint32_t getJedecId() {return this->jedecId;};
 			std::string getManufacturerName() {return std::string(this->manufacturer->name);};
 
 			int16_t getOpCode_writeEnable() {
@@ -79,10 +86,30 @@ namespace flash {
 				if (this->desc->chipErase != -1) return this->desc->chipErase;
 				return this->manufacturer->chipErase;
 			};
+			int16_t getOpCode_blockErase() {
+				if (this->desc->blockErase != -1) return this->desc->blockErase;
+				return this->manufacturer->blockErase;
+			};
+			int16_t getOpCode_sectorErase() {
+				if (this->desc->sectorErase != -1) return this->desc->sectorErase;
+				return this->manufacturer->sectorErase;
+			};
+			int16_t getOpCode_extendedAddress() {
+				if (this->desc->extendedAddress != -1) return this->desc->extendedAddress;
+				return this->manufacturer->extendedAddress;
+			};
 
 			std::string getName() {return std::string(this->desc->name);};
 			uint32_t getSize() {return this->desc->size_kb * 1024;};
 			uint32_t getPageSize() {return this->desc->pageSize;};
 			uint32_t getBlockSize() {return this->desc->blockSize_kb * 1024;};
+
+			// The smallest erasable unit: a 4 KB sector, or the whole block if the chip can't erase sectors
+			static const uint32_t SECTOR_SIZE = 4 * 1024;
+			uint32_t getSectorSize() {return this->getOpCode_sectorErase() != -1 ? SECTOR_SIZE : this->getBlockSize();};
+
+			// The controller sends 3 byte addresses, larger chips are accessed in 16 MB banks
+			static const uint32_t BANK_SIZE = 16 * 1024 * 1024;
+			uint32_t getBankCount() {return (this->getSize() + BANK_SIZE - 1) / BANK_SIZE;};
 	};
 };
\ No newline at end of file
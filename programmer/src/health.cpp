@@ -0,0 +1,100 @@
+#include <plog/Log.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "health.h"
+
+using namespace health;
+
+monitor::monitor() {
+	this->ceiling = TRANSFER_MIN;
+	this->transferSize = TRANSFER_MIN;
+	this->pacing = 0;
+	this->streak = 0;
+
+	this->transactions = 0;
+	this->errors = 0;
+	this->retries = 0;
+	this->bytes = 0;
+	this->busyTime = 0;
+	this->latency = 0;
+}
+
+void monitor::setCeiling(size_t size) {
+	if (size < TRANSFER_MIN) size = TRANSFER_MIN;
+	this->ceiling = size;
+	this->transferSize = size;
+	this->streak = 0;
+}
+
+void monitor::pace() {
+	if (this->pacing > 0) usleep(this->pacing);
+}
+
+void monitor::success(uint64_t duration, size_t length, bool dataTransfer) {
+	this->transactions++;
+	this->bytes += length;
+	this->busyTime += duration;
+
+	bool slow = this->latency > 0 && duration > 4 * this->latency;
+	this->latency = (this->latency == 0) ? duration : this->latency * 0.9 + duration * 0.1;
+
+	if (slow) {
+		this->streak = 0;
+		return;
+	}
+
+	if (++this->streak < GROW_AFTER) return;
+	this->streak = 0;
+
+	if (this->pacing > 0) {
+		this->pacing /= 2;
+		if (this->pacing < PACING_STEP) this->pacing = 0;
+		PLOG_DEBUG << "[health] Pacing decreased to " << std::dec << this->pacing << " us";
+	} else if (dataTransfer && this->transferSize < this->ceiling) {
+		this->transferSize *= 2;
+		if (this->transferSize > this->ceiling) this->transferSize = this->ceiling;
+		PLOG_DEBUG << "[health] Transfer size increased to " << std::dec << this->transferSize << " byte";
+	}
+}
+
+void monitor::failure(int error) {
+	this->transactions++;
+	this->errors++;
+	this->streak = 0;
+
+	size_t previous = this->transferSize;
+	this->transferSize /= 2;
+	if (this->transferSize < TRANSFER_MIN) this->transferSize = TRANSFER_MIN;
+
+	this->pacing = (this->pacing == 0) ? PACING_STEP : this->pacing * 2;
+	if (this->pacing > PACING_MAX) this->pacing = PACING_MAX;
+
+	PLOG_WARNING << "[health] Bus error (" << strerror(error) << "), transfer size " << std::dec << previous << " -> "
+		<< this->transferSize << " byte, pacing " << this->pacing << " us";
+}
+
+void monitor::report() {
+	if (this->transactions == 0) return;
+
+	PLOG_INFO << "[health] " << std::dec << this->transactions << " transaction(s), " << this->errors << " error(s) ("
+		<< (100.0 * this->errors / this->transactions) << "%), " << this->retries << " retry(s), average latency "
+		<< (int)(this->latency / 1000) << " us, " << (this->busyTime > 0 ? (int)(this->bytes * 1e9 / this->busyTime / 1024) : 0)
+		<< " kb/s on the bus, final transfer size " << this->transferSize << " byte, pacing " << this->pacing << " us";
+}
+
+bool health::isRecoverable(int error) {
+	switch (error) {
+		case EIO:        // no ACK / bus error (most adapters)
+		case ENXIO:      // no ACK of the address
+		case EREMOTEIO:  // no ACK of a data byte
+		case ETIMEDOUT:  // clock stretched too long
+		case EAGAIN:     // arbitration lost
+		case EBUSY:      // the bus is busy
+		case EPROTO:     // SMBus protocol error (length / PEC)
+			return true;
+		default:
+			return false;
+	}
+}
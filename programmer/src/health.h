@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace health {
+
+	// Retries of one transaction before the error goes up to the caller
+	const int RETRY_MAX = 4;
+	// Pacing between the transactions after errors (us)
+	const uint32_t PACING_STEP = 100;
+	const uint32_t PACING_MAX = 10000;
+	// Successful transfers before the transfer size grows / the pacing shrinks
+	const int GROW_AFTER = 32;
+	// The smallest data transfer the monitor backs off to
+	const size_t TRANSFER_MIN = 8;
+
+	/*
+		Bus health of one connection: transaction latency and error rate.
+
+		An error halves the data transfer size and adds pacing between the transactions,
+		a streak of successful transfers doubles it back towards the ceiling (the probed
+		or the planned size) and takes the pacing away. A transfer much slower than the
+		average doesn't count into the streak, a slow link isn't pushed further.
+	*/
+
+	class monitor {
+		private:
+			size_t ceiling;
+			size_t transferSize;
+			uint32_t pacing;
+			int streak;
+
+			uint64_t transactions;
+			uint64_t errors;
+			uint64_t retries;
+			uint64_t bytes;
+			uint64_t busyTime;	// ns
+			double latency;		// average of one transaction (ns, moving average)
+
+		public:
+			monitor();
+
+			// The largest transfer, the current one starts from here
+			void setCeiling(size_t size);
+			size_t getCeiling() {return this->ceiling;};
+			size_t getTransferSize() {return this->transferSize;};
+			uint32_t getPacing() {return this->pacing;};
+
+			// Waits the pacing before a transaction
+			void pace();
+
+			void success(uint64_t duration, size_t length, bool dataTransfer);
+			void failure(int error);
+			void retry() {this->retries++;};
+
+			uint64_t getErrors() {return this->errors;};
+			void report();
+	};
+
+	// NACK, timeout and arbitration errors of a marginal link, worth a retry
+	bool isRecoverable(int error);
+
+};
@@ -1,17 +1,23 @@
 #include <plog/Log.h>
 #include <iostream>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 
 extern "C"
 {
+  #include <linux/i2c.h>
   #include <linux/i2c-dev.h>
   #include <i2c/smbus.h>
 }
 
 #include "i2c.h"
+#include "trace.h"
+#include "health.h"
+#include "probes.h"
 
 using namespace i2c;
 
@@ -19,6 +25,10 @@ connection::connection(int adapter, uint8_t address) {
 	this->adapter = adapter;
 	this->address = address;
 	this->file = -1;
+	this->health.setCeiling(SMBUS_BLOCK_MAX);
+	this->recorder = NULL;
+	this->deadline = 0;
+	this->writeCeiling = SMBUS_BLOCK_MAX;
 	this->filename =  "/dev/i2c-" + std::to_string(adapter);
 
 	PLOG_DEBUG << "[i2c-connection] New i2c connector created (Adapter: " << std::to_string(this->adapter)
@@ -64,26 +74,332 @@ void connection::close() {
 	this->file = -1;
 }
 
+bool connection::isExpired() {
+	return this->deadline != 0 && trace::now() >= this->deadline;
+}
+
+void connection::pace() {
+	if (this->isExpired()) throw i2c::exception("The time limit of the connection is over");
+	this->health.pace();
+}
+
+// A failed transaction: retried after the back off if the error is recoverable, thrown otherwise
+void connection::failed(int error, int attempt, const char *message) {
+	this->health.failure(error);
+
+	if (!health::isRecoverable(error) || attempt >= health::RETRY_MAX) throw i2c::exception(message);
+
+	PLOG_DEBUG << "[i2c-connection] " << message << " (" << strerror(error) << "), retry " << std::dec << attempt + 1;
+	this->health.retry();
+}
+
+// The register byte transactions are safe to repeat, the transfers of the data ports are not:
+// a failed port transfer is thrown, the device driver repeats the whole operation
+
 void connection::write(uint8_t reg, uint8_t data) {
-	if (i2c_smbus_write_byte_data(this->file, reg, data) < 0) throw i2c::exception("Unable to write i2c device");
+	this->writeByte(reg, data, true);
 }
 
 uint8_t connection::read(uint8_t reg) {
-	int32_t result;
-	if ((result = i2c_smbus_read_byte_data(this->file, reg)) == -1) throw i2c::exception("Unable to read i2c device");
-	return (uint8_t)result;
+	return this->readByte(reg, true);
+}
+
+void connection::writePort(uint8_t reg, uint8_t data) {
+	this->writeByte(reg, data, false);
+}
+
+uint8_t connection::readPort(uint8_t reg) {
+	return this->readByte(reg, false);
+}
+
+void connection::writeByte(uint8_t reg, uint8_t data, bool retry) {
+	for (int attempt = 0;; attempt++) {
+		this->pace();
+
+		uint64_t start = trace::now();
+		ODC_PROBE2(i2c__start, trace::op_write, reg);
+		int32_t result = i2c_smbus_write_byte_data(this->file, reg, data);
+		int error = errno;
+		ODC_PROBE4(i2c__done, trace::op_write, reg, 1, result < 0 ? trace::status_failed : trace::status_ok);
+		if (this->recorder) this->recorder->record(trace::op_write, reg, &data, 1, result < 0 ? trace::status_failed : trace::status_ok, start);
+
+		if (result >= 0) {
+			this->health.success(trace::now() - start, 1, false);
+			return;
+		}
+
+		this->failed(error, retry ? attempt : health::RETRY_MAX, "Unable to write i2c device");
+	}
+}
+
+uint8_t connection::readByte(uint8_t reg, bool retry) {
+	for (int attempt = 0;; attempt++) {
+		this->pace();
+
+		uint64_t start = trace::now();
+		ODC_PROBE2(i2c__start, trace::op_read, reg);
+		int32_t result = i2c_smbus_read_byte_data(this->file, reg);
+		int error = errno;
+		ODC_PROBE4(i2c__done, trace::op_read, reg, result == -1 ? 0 : 1, result == -1 ? trace::status_failed : trace::status_ok);
+		uint8_t data = result;
+		if (this->recorder) this->recorder->record(trace::op_read, reg, &data, result == -1 ? 0 : 1, result == -1 ? trace::status_failed : trace::status_ok, start);
+
+		if (result != -1) {
+			this->health.success(trace::now() - start, 1, false);
+			return (uint8_t)result;
+		}
+
+		this->failed(error, retry ? attempt : health::RETRY_MAX, "Unable to read i2c device");
+	}
 }
 
 void connection::writeBlock(uint8_t reg, uint8_t *data, uint8_t len) {
-	if (i2c_smbus_write_i2c_block_data(this->file, reg, len, data) < 0) throw i2c::exception("Unable to write i2c device");
+	this->pace();
+
+	uint64_t start = trace::now();
+	ODC_PROBE2(i2c__start, trace::op_write_block, reg);
+	int32_t result = i2c_smbus_write_i2c_block_data(this->file, reg, len, data);
+	int error = errno;
+	ODC_PROBE4(i2c__done, trace::op_write_block, reg, len, result < 0 ? trace::status_failed : trace::status_ok);
+	if (this->recorder) this->recorder->record(trace::op_write_block, reg, data, len, result < 0 ? trace::status_failed : trace::status_ok, start);
+
+	if (result < 0) {
+		this->health.failure(error);
+		throw i2c::exception("Unable to write i2c device");
+	}
+
+	this->health.success(trace::now() - start, len, true);
 }
 
 uint8_t connection::readBlock(uint8_t reg, uint8_t *dest, uint8_t len) {
-	int read;
-	if ((read = i2c_smbus_read_i2c_block_data(this->file, reg, len, dest)) == -1) throw i2c::exception("Unable to read i2c device");
+	this->pace();
+
+	uint64_t start = trace::now();
+	ODC_PROBE2(i2c__start, trace::op_read_block, reg);
+	int read = i2c_smbus_read_i2c_block_data(this->file, reg, len, dest);
+	int error = errno;
+	ODC_PROBE4(i2c__done, trace::op_read_block, reg, read == -1 ? 0 : read, read == -1 ? trace::status_failed : trace::status_ok);
+	if (this->recorder) this->recorder->record(trace::op_read_block, reg, dest, read == -1 ? 0 : read, read == -1 ? trace::status_failed : trace::status_ok, start);
+
+	if (read == -1) {
+		this->health.failure(error);
+		throw i2c::exception("Unable to read i2c device");
+	}
+
+	this->health.success(trace::now() - start, read, true);
 	return read;
 }
 
+bool connection::hasRawSupport() {
+	unsigned long funcs;
+	if (ioctl(this->file, I2C_FUNCS, &funcs) < 0) return false;
+	return (funcs & I2C_FUNC_I2C) != 0;
+}
+
+// The raw transfers return false if the adapter refused the message before anything went to the bus
+// (message too long / plain i2c not supported), and throw if the transfer itself failed
+
+bool connection::writeRaw(uint8_t reg, uint8_t *data, size_t len) {
+	if (len > RAW_TRANSFER_MAX) throw i2c::exception("Raw i2c transfer is too long");
+
+	this->rawBuffer[0] = reg;
+	memcpy(this->rawBuffer + 1, data, len);
+
+	struct i2c_msg msg;
+	msg.addr = this->address;
+	msg.flags = 0;
+	msg.len = len + 1;
+	msg.buf = this->rawBuffer;
+
+	struct i2c_rdwr_ioctl_data rdwr;
+	rdwr.msgs = &msg;
+	rdwr.nmsgs = 1;
+
+	this->pace();
+
+	uint64_t start = trace::now();
+	ODC_PROBE2(i2c__start, trace::op_write_raw, reg);
+	int result = ioctl(this->file, I2C_RDWR, &rdwr);
+	int error = errno;
+	bool refused = result < 0 && (error == EOPNOTSUPP || error == EINVAL);
+	ODC_PROBE4(i2c__done, trace::op_write_raw, reg, len, result >= 0 ? trace::status_ok : (refused ? trace::status_refused : trace::status_failed));
+	if (this->recorder) this->recorder->record(trace::op_write_raw, reg, data, len,
+		result >= 0 ? trace::status_ok : (refused ? trace::status_refused : trace::status_failed), start);
+
+	if (result < 0) {
+		if (refused) return false;
+		this->health.failure(error);
+		throw i2c::exception("Unable to write i2c device");
+	}
+
+	this->health.success(trace::now() - start, len, true);
+	return true;
+}
+
+bool connection::readRaw(uint8_t reg, uint8_t *dest, size_t len) {
+	if (len > RAW_TRANSFER_MAX) throw i2c::exception("Raw i2c transfer is too long");
+
+	// Register address write, then a repeated start and the read itself
+	struct i2c_msg msgs[2];
+	msgs[0].addr = this->address;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &reg;
+	msgs[1].addr = this->address;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = len;
+	msgs[1].buf = dest;
+
+	struct i2c_rdwr_ioctl_data rdwr;
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = 2;
+
+	this->pace();
+
+	uint64_t start = trace::now();
+	ODC_PROBE2(i2c__start, trace::op_read_raw, reg);
+	int result = ioctl(this->file, I2C_RDWR, &rdwr);
+	int error = errno;
+	bool refused = result < 0 && (error == EOPNOTSUPP || error == EINVAL);
+	ODC_PROBE4(i2c__done, trace::op_read_raw, reg, result < 0 ? 0 : len, result >= 0 ? trace::status_ok : (refused ? trace::status_refused : trace::status_failed));
+	if (this->recorder) this->recorder->record(trace::op_read_raw, reg, dest, result < 0 ? 0 : len,
+		result >= 0 ? trace::status_ok : (refused ? trace::status_refused : trace::status_failed), start);
+
+	if (result < 0) {
+		if (refused) return false;
+		this->health.failure(error);
+		throw i2c::exception("Unable to read i2c device");
+	}
+
+	this->health.success(trace::now() - start, len, true);
+	return true;
+}
+
+void connection::setMaxTransferSize(size_t size) {
+	if (size < SMBUS_BLOCK_MAX) size = SMBUS_BLOCK_MAX;
+	if (size > RAW_TRANSFER_MAX) size = RAW_TRANSFER_MAX;
+	this->health.setCeiling(size);
+
+	PLOG_DEBUG << "[i2c-connection] Maximum transfer size: " << std::dec << size << " byte ("
+		<< (size > SMBUS_BLOCK_MAX ? "i2c" : "SMBus") << ")";
+}
+
+void connection::setMaxWriteSize(size_t size) {
+	if (size < SMBUS_BLOCK_MAX) size = SMBUS_BLOCK_MAX;
+	if (size > RAW_TRANSFER_MAX) size = RAW_TRANSFER_MAX;
+	this->writeCeiling = size;
+
+	PLOG_DEBUG << "[i2c-connection] Maximum write size: " << std::dec << size << " byte";
+}
+
+void connection::fallbackToSMBus(const char *reason) {
+	PLOG_WARNING << "[i2c-connection] " << reason << ", fall back to SMBus block transfers";
+	this->health.setCeiling(SMBUS_BLOCK_MAX);
+	this->writeCeiling = SMBUS_BLOCK_MAX;
+}
+
+void connection::writeBatch(const write_s *writes, size_t count) {
+	static_assert(sizeof(write_s) == 2, "a batch write must be one 2 byte i2c message");
+
+	// Plain i2c is known to work only after the transfer size probe
+	for (int attempt = 0; count > 0 && this->health.getCeiling() > SMBUS_BLOCK_MAX;) {
+		size_t chunkSize = count;
+		if (chunkSize > BATCH_MAX) chunkSize = BATCH_MAX;
+
+		struct i2c_msg msgs[BATCH_MAX];
+		for (size_t i = 0; i < chunkSize; i++) {
+			msgs[i].addr = this->address;
+			msgs[i].flags = 0;
+			msgs[i].len = 2;
+			msgs[i].buf = (uint8_t *)&writes[i];
+		}
+
+		struct i2c_rdwr_ioctl_data rdwr;
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = chunkSize;
+
+		this->pace();
+
+		uint64_t start = trace::now();
+		// One transaction of chunkSize register writes, reported as a write of the first register
+		ODC_PROBE2(i2c__start, trace::op_write, writes[0].reg);
+		int result = ioctl(this->file, I2C_RDWR, &rdwr);
+		int error = errno;
+		bool refused = result < 0 && (error == EOPNOTSUPP || error == EINVAL);
+		ODC_PROBE4(i2c__done, trace::op_write, writes[0].reg, chunkSize, result >= 0 ? trace::status_ok : (refused ? trace::status_refused : trace::status_failed));
+
+		if (this->recorder && !refused) {
+			for (size_t i = 0; i < chunkSize; i++) {
+				this->recorder->record(trace::op_write, writes[i].reg, &writes[i].data, 1, result < 0 ? trace::status_failed : trace::status_ok, start);
+			}
+		}
+
+		if (result < 0) {
+			if (refused) {
+				this->fallbackToSMBus("The adapter refused the batch write");
+				break;
+			}
+			// Register writes: the whole chunk can be sent again
+			this->failed(error, attempt++, "Unable to write i2c device");
+			continue;
+		}
+
+		this->health.success(trace::now() - start, 0, false);
+		attempt = 0;
+
+		writes += chunkSize;
+		count -= chunkSize;
+	}
+
+	for (size_t i = 0; i < count; i++) this->write(writes[i].reg, writes[i].data);
+}
+
+void connection::writeData(uint8_t reg, uint8_t *data, size_t len) {
+	while (len > 0) {
+		// The current transfer size of the health monitor within the validated write size, plain i2c above the SMBus block size
+		size_t chunkSize = len;
+		if (chunkSize > this->health.getTransferSize()) chunkSize = this->health.getTransferSize();
+		if (chunkSize > this->writeCeiling) chunkSize = this->writeCeiling;
+
+		if (chunkSize > SMBUS_BLOCK_MAX) {
+			if (!this->writeRaw(reg, data, chunkSize)) {
+				this->fallbackToSMBus("The adapter refused the raw write");
+				continue;
+			}
+		} else this->writeBlock(reg, data, chunkSize);
+
+		data += chunkSize;
+		len -= chunkSize;
+	}
+}
+
+size_t connection::readData(uint8_t reg, uint8_t *dest, size_t len) {
+	size_t total = 0;
+
+	while (len > 0) {
+		size_t chunkSize = len;
+		if (chunkSize > this->health.getTransferSize()) chunkSize = this->health.getTransferSize();
+
+		size_t readed;
+		if (chunkSize > SMBUS_BLOCK_MAX) {
+			if (!this->readRaw(reg, dest, chunkSize)) {
+				this->fallbackToSMBus("The adapter refused the raw read");
+				continue;
+			}
+			readed = chunkSize;
+		} else readed = this->readBlock(reg, dest, chunkSize);
+
+		if (readed == 0) break;
+
+		total += readed;
+		dest += readed;
+		len -= readed;
+	}
+
+	return total;
+}
+
 connection::~connection() {
+	this->health.report();
 	if (this->isOpened()) this->close();
 }
@@ -2,9 +2,29 @@
 
 #include <string>
 #include <exception>
+#include <stdint.h>
+#include "health.h"
+
+namespace trace {
+	class recorder;
+};
 
 namespace i2c {
 
+	// The largest data block of an SMBus "i2c block" transfer
+	const size_t SMBUS_BLOCK_MAX = 32;
+	// The largest plain i2c (I2C_RDWR) message we ever try, bounded by the 1kb flash read window
+	const size_t RAW_TRANSFER_MAX = 1024;
+
+	// The most messages in one I2C_RDWR call (I2C_RDWR_IOCTL_MAX_MSGS of the kernel)
+	const size_t BATCH_MAX = 42;
+
+	// One register write of a batch, laid out as its i2c message: register address, data
+	struct write_s {
+		uint8_t reg;
+		uint8_t data;
+	};
+
 	class exception : public std::exception {
 		public:
 			exception(const std::string m="unnamed exception"):msg(m){};
@@ -21,6 +41,20 @@ namespace i2c {
 			int adapter;
 			uint8_t address;
 
+			health::monitor health;
+			trace::recorder *recorder;
+			uint64_t deadline;
+			size_t writeCeiling;
+			uint8_t rawBuffer[1 + RAW_TRANSFER_MAX];
+
+			// Checks the deadline and waits the pacing before a transaction
+			void pace();
+			void fallbackToSMBus(const char *reason);
+			void failed(int error, int attempt, const char *message);
+
+			void writeByte(uint8_t reg, uint8_t data, bool retry);
+			uint8_t readByte(uint8_t reg, bool retry);
+
 		public:
 			connection(int adapter, uint8_t address);
 
@@ -31,9 +65,45 @@ namespace i2c {
 			void write(uint8_t reg, uint8_t data);
 			uint8_t read(uint8_t reg);
 
+			// One byte of an auto incremented data port: not retried, a failed transfer may have moved
+			// the port address already, the caller repeats the whole access from the address setup
+			void writePort(uint8_t reg, uint8_t data);
+			uint8_t readPort(uint8_t reg);
+
 			void writeBlock(uint8_t reg, uint8_t *data, uint8_t len);
 			uint8_t readBlock(uint8_t reg, uint8_t *dest, uint8_t len);
 
+			// Plain i2c messages (register address + payload in one message) through I2C_RDWR
+			bool hasRawSupport();
+			bool writeRaw(uint8_t reg, uint8_t *data, size_t len);
+			bool readRaw(uint8_t reg, uint8_t *dest, size_t len);
+
+			// The largest data transfer in writeData/readData, more than SMBUS_BLOCK_MAX means I2C_RDWR.
+			// The health monitor goes below it after bus errors and grows back to it.
+			void setMaxTransferSize(size_t size);
+			size_t getMaxTransferSize() {return this->health.getCeiling();};
+			size_t getTransferSize() {return this->health.getTransferSize();};
+			health::monitor &getHealth() {return this->health;};
+
+			// The largest data write: the probe reads only, so writes stay at SMBUS_BLOCK_MAX
+			// until a raw write of this size was programmed and CRC checked (the bench mode, isp::session::open applies it)
+			void setMaxWriteSize(size_t size);
+			size_t getMaxWriteSize() {return this->writeCeiling;};
+
+			// Every transaction is written into the recorder (NULL: no trace), the connection doesn't own it
+			void setRecorder(trace::recorder *recorder) {this->recorder = recorder;};
+
+			// The transactions after this trace::now() time are refused (0: no limit), a probe can't hang on a bus
+			void setDeadline(uint64_t deadline) {this->deadline = deadline;};
+			bool isExpired();
+
+			// Register writes in their order, one I2C_RDWR call per BATCH_MAX writes when plain i2c is in use
+			void writeBatch(const write_s *writes, size_t count);
+
+			// Move 'len' byte to/from a register port in as few transfers as possible
+			void writeData(uint8_t reg, uint8_t *data, size_t len);
+			size_t readData(uint8_t reg, uint8_t *dest, size_t len);
+
 			~connection();
 	};
 
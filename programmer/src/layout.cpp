@@ -0,0 +1,240 @@
+#include <plog/Log.h>
+#include <CRC.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "layout.h"
+#include "stream.h"
+
+using namespace layout;
+
+static const uint8_t blank[256] = {
+	#define B8 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+	#define B64 B8, B8, B8, B8, B8, B8, B8, B8
+	B64, B64, B64, B64
+	#undef B64
+	#undef B8
+};
+
+// Calls f(offset, data, length) along the range, data is NULL in the blank gaps
+template <typename F> static void walk(std::vector<segment_s> &segments, uint32_t address, uint32_t size, F f) {
+	uint64_t end = (uint64_t)address + size;
+	uint32_t current = address;
+
+	std::vector<segment_s>::iterator it = segments.begin();
+	while (it != segments.end() && it->address + it->size <= current) ++it;
+
+	while (current < end) {
+		if (it == segments.end() || it->address >= end) {
+			f(current - address, (const uint8_t*)NULL, (uint32_t)(end - current));
+			break;
+		}
+
+		if (it->address > current) {
+			f(current - address, (const uint8_t*)NULL, it->address - current);
+			current = it->address;
+		}
+
+		uint32_t stop = std::min(end, (uint64_t)it->address + it->size);
+		f(current - address, it->data + (current - it->address), stop - current);
+		current = stop;
+		++it;
+	}
+}
+
+image::~image() {
+	for (size_t i = 0; i < this->maps.size(); i++) munmap(this->maps[i].first, this->maps[i].second);
+	for (size_t i = 0; i < this->buffers.size(); i++) delete this->buffers[i];
+}
+
+void image::add(uint32_t address, std::string filename) {
+	segment_s segment;
+	segment.address = address;
+	segment.filename = filename;
+
+	struct stat st;
+	int fd = -1;
+	if (filename != "-") {
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			if (fd >= 0) close(fd);
+			throw layout::exception("Unable to open the segment file: " + filename);
+		}
+	}
+
+	if (fd >= 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			close(fd);
+			throw layout::exception("The segment file is empty: " + filename);
+		}
+		if ((uint64_t)address + st.st_size > 0xFFFFFFFFull) {
+			close(fd);
+			throw layout::exception("The segment doesn't fit into the address space: " + filename);
+		}
+
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) throw layout::exception("Unable to map the segment file: " + filename);
+
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		this->maps.push_back(std::make_pair(map, (size_t)st.st_size));
+
+		segment.data = (const uint8_t*)map;
+		segment.size = st.st_size;
+	} else {
+		if (fd >= 0) close(fd);
+
+		// A pipe can't be mapped, its content is read into the memory
+		stream::file input(filename, false);
+		std::vector<uint8_t> *buffer = new std::vector<uint8_t>();
+		this->buffers.push_back(buffer);
+
+		const size_t step = 64 * 1024;
+		while (1) {
+			size_t used = buffer->size();
+			buffer->resize(used + step);
+			size_t readed = input.read(&(*buffer)[used], step);
+			buffer->resize(used + readed);
+			if (readed == 0) break;
+		}
+
+		if (buffer->empty()) throw layout::exception("The segment file is empty: " + filename);
+
+		segment.data = &(*buffer)[0];
+		segment.size = buffer->size();
+	}
+
+	for (size_t i = 0; i < this->segments.size(); i++) {
+		segment_s &other = this->segments[i];
+		if (segment.address < other.address + other.size && other.address < segment.address + segment.size) {
+			throw layout::exception("The segments overlap: " + filename + " / " + other.filename);
+		}
+	}
+
+	std::vector<segment_s>::iterator it = this->segments.begin();
+	while (it != this->segments.end() && it->address < segment.address) ++it;
+	this->segments.insert(it, segment);
+
+	PLOG_DEBUG << "[layout] Segment 0x" << std::hex << segment.address << " - 0x" << (segment.address + segment.size - 1) << ": " << filename;
+}
+
+void image::truncate(uint32_t size) {
+	while (!this->segments.empty() && this->segments.back().address >= size) this->segments.pop_back();
+	if (!this->segments.empty() && this->segments.back().address + this->segments.back().size > size) {
+		this->segments.back().size = size - this->segments.back().address;
+	}
+}
+
+uint32_t image::size() {
+	if (this->segments.empty()) return 0;
+	return this->segments.back().address + this->segments.back().size;
+}
+
+const uint8_t *image::direct(uint32_t address, uint32_t size) {
+	for (size_t i = 0; i < this->segments.size(); i++) {
+		segment_s &segment = this->segments[i];
+		if (address >= segment.address && (uint64_t)address + size <= (uint64_t)segment.address + segment.size) {
+			return segment.data + (address - segment.address);
+		}
+	}
+	return NULL;
+}
+
+void image::copy(uint32_t address, uint8_t *buffer, uint32_t size) {
+	walk(this->segments, address, size, [&](uint32_t offset, const uint8_t *data, uint32_t length) {
+		if (data == NULL) memset(buffer + offset, 0xFF, length);
+		else memcpy(buffer + offset, data, length);
+	});
+}
+
+bool image::equals(uint32_t address, const uint8_t *buffer, uint32_t size) {
+	bool equal = true;
+	walk(this->segments, address, size, [&](uint32_t offset, const uint8_t *data, uint32_t length) {
+		if (!equal) return;
+		if (data != NULL) equal = memcmp(buffer + offset, data, length) == 0;
+		else for (uint32_t i = 0; i < length && equal; i++) equal = buffer[offset + i] == 0xFF;
+	});
+	return equal;
+}
+
+bool image::isBlank(uint32_t address, uint32_t size) {
+	bool isBlank = true;
+	walk(this->segments, address, size, [&](uint32_t /*offset*/, const uint8_t *data, uint32_t length) {
+		if (!isBlank || data == NULL) return;
+		for (uint32_t i = 0; i < length; i++) {
+			if (data[i] != 0xFF) {
+				isBlank = false;
+				return;
+			}
+		}
+	});
+	return isBlank;
+}
+
+uint8_t image::crc(uint32_t address, uint32_t size) {
+	uint8_t crc = 0;
+	bool first = true;
+
+	auto feed = [&](const uint8_t *data, uint32_t length) {
+		crc = first ? CRC::Calculate(data, length, CRC::CRC_8()) : CRC::Calculate(data, length, CRC::CRC_8(), crc);
+		first = false;
+	};
+
+	walk(this->segments, address, size, [&](uint32_t /*offset*/, const uint8_t *data, uint32_t length) {
+		if (data != NULL) {
+			feed(data, length);
+			return;
+		}
+		for (uint32_t done = 0; done < length; done += sizeof(blank)) feed(blank, std::min((uint32_t)sizeof(blank), length - done));
+	});
+
+	return crc;
+}
+
+void layout::load(std::string filename, image &result) {
+	std::ifstream file(filename.c_str());
+	if (!file) throw layout::exception("Unable to open the layout: " + filename);
+
+	std::string directory;
+	size_t slash = filename.rfind('/');
+	if (slash != std::string::npos) directory = filename.substr(0, slash + 1);
+
+	std::string line;
+	int number = 0;
+
+	while (std::getline(file, line)) {
+		number++;
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line = line.substr(0, comment);
+
+		std::istringstream tokens(line);
+		std::string offset, segment, rest;
+
+		if (!(tokens >> offset)) continue;
+
+		std::stringstream msg;
+		msg << "line " << number << ": ";
+
+		if (!(tokens >> segment) || (tokens >> rest)) throw layout::exception(msg.str() + "expected <offset> <file>");
+
+		char *end;
+		unsigned long address = strtoul(offset.c_str(), &end, 0);
+		if (*end != 0 || address > 0xFFFFFFFFul) throw layout::exception(msg.str() + "invalid offset: " + offset);
+
+		if (segment[0] != '/') segment = directory + segment;
+
+		result.add(address, segment);
+	}
+
+	if (result.getSegments().empty()) throw layout::exception("The layout has no segments: " + filename);
+
+	PLOG_INFO << "[layout] " << std::dec << result.getSegments().size() << " segment(s), 0x" << std::hex << result.size() << " byte image";
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+
+namespace layout {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Layout descriptor: one segment per line, '#' starts a comment, the offsets can be hex (0x...)
+		The relative file names are relative to the descriptor.
+
+			<offset> <file>
+
+		The segments can't overlap, the gaps between them are blank (0xFF) flash.
+	*/
+
+	struct segment_s {
+		uint32_t address;
+		uint32_t size;
+		const uint8_t *data;
+		std::string filename;
+	};
+
+	// Flash image made of file segments. The files are memory-mapped, the image is never
+	// merged into one buffer: the callers take their windows / pages from the segments.
+	// (A stream like stdin can't be mapped, it is read into the memory)
+
+	class image {
+		private:
+			std::vector<segment_s> segments; // sorted by address
+			std::vector<std::pair<void*, size_t> > maps;
+			std::vector<std::vector<uint8_t>*> buffers;
+
+			image(const image&);
+			image &operator=(const image&);
+
+		public:
+			image() {};
+			~image();
+
+			void add(uint32_t address, std::string filename);
+			// Drops the content after 'size' (the part of a plain binary which doesn't fit into the flash)
+			void truncate(uint32_t size);
+
+			std::vector<segment_s> &getSegments() {return this->segments;};
+			// End of the last segment
+			uint32_t size();
+
+			// Pointer into one segment if the range is inside it, NULL otherwise
+			const uint8_t *direct(uint32_t address, uint32_t size);
+			// The range assembled from the segments and the blank gaps
+			void copy(uint32_t address, uint8_t *buffer, uint32_t size);
+			bool equals(uint32_t address, const uint8_t *buffer, uint32_t size);
+
+			bool isBlank(uint32_t address, uint32_t size);
+			// CRC-8 of the range, continued across the segments and the gaps
+			uint8_t crc(uint32_t address, uint32_t size);
+	};
+
+	void load(std::string filename, image &result);
+
+};
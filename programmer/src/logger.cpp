@@ -0,0 +1,160 @@
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <exception>
+#include <stdlib.h>
+#include "logger.h"
+
+using namespace logger;
+
+// The terminate handler flushes this one before the abort
+static async *instance = NULL;
+
+static void onTerminate() {
+	if (instance != NULL) instance->flush();
+	abort();
+}
+
+async::async(const char *filename, FILE *console) {
+	this->ring = new slot_s[RING_SIZE];
+	for (size_t i = 0; i < RING_SIZE; i++) this->ring[i].sequence.store(i, std::memory_order_relaxed);
+
+	this->head.store(0);
+	this->tail = 0;
+	this->flushed.store(0);
+	this->dropped.store(0);
+	this->reported = 0;
+	this->stopping.store(false);
+
+	this->file = fopen(filename, "a");
+	if (this->file != NULL) setvbuf(this->file, NULL, _IOFBF, 64 * 1024);
+
+	this->console = console;
+	this->colors = console != NULL && isatty(fileno(console));
+
+	instance = this;
+	std::set_terminate(onTerminate);
+
+	this->writer = std::thread(&async::run, this);
+}
+
+void async::write(const plog::Record &record) {
+	size_t pos = this->head.load(std::memory_order_relaxed);
+	slot_s *slot;
+
+	// Claim a slot: its sequence equals the position when it is free for this round
+	while (1) {
+		slot = &this->ring[pos & (RING_SIZE - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		} else if (diff < 0) {
+			// full, the writer is behind by a whole ring
+			this->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else pos = this->head.load(std::memory_order_relaxed);
+	}
+
+	slot->severity = record.getSeverity();
+	slot->time = record.getTime().time;
+	slot->millitm = record.getTime().millitm;
+	slot->tid = record.getTid();
+	slot->line = record.getLine();
+	strncpy(slot->func, record.getFunc(), FUNC_MAX - 1);
+	slot->func[FUNC_MAX - 1] = 0;
+	strncpy(slot->message, record.getMessage(), MESSAGE_MAX - 1);
+	slot->message[MESSAGE_MAX - 1] = 0;
+
+	// Publish the slot for the writer
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool async::drain() {
+	bool any = false;
+
+	while (1) {
+		slot_s &slot = this->ring[this->tail & (RING_SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != this->tail + 1) break;
+
+		this->output(slot);
+
+		// Free the slot for the next round of the ring
+		slot.sequence.store(this->tail + RING_SIZE, std::memory_order_release);
+		this->tail++;
+		any = true;
+	}
+
+	uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+	if (dropped != this->reported) {
+		if (this->file != NULL) fprintf(this->file, "[logger] %llu record(s) dropped, the log ring was full\n", (unsigned long long)(dropped - this->reported));
+		this->reported = dropped;
+		any = true;
+	}
+
+	return any;
+}
+
+void async::output(slot_s &slot) {
+	struct tm t;
+	localtime_r(&slot.time, &t);
+
+	char header[128];
+	snprintf(header, sizeof(header), "%04d-%02d-%02d %02d:%02d:%02d.%03d %-5s [%u] [%s@%zu] ",
+		t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, slot.millitm,
+		plog::severityToString(slot.severity), slot.tid, slot.func, slot.line);
+
+	if (this->file != NULL) fprintf(this->file, "%s%s\n", header, slot.message);
+
+	if (this->console == NULL) return;
+
+	// Same colors as plog::ColorConsoleAppender
+	const char *color = NULL;
+	switch (slot.severity) {
+		case plog::fatal: color = "\x1B[97m\x1B[41m"; break;
+		case plog::error: color = "\x1B[91m"; break;
+		case plog::warning: color = "\x1B[93m"; break;
+		case plog::debug:
+		case plog::verbose: color = "\x1B[96m"; break;
+		default: break;
+	}
+
+	if (this->colors && color != NULL) fprintf(this->console, "%s%s%s\x1B[0m\x1B[0K\n", color, header, slot.message);
+	else fprintf(this->console, "%s%s\n", header, slot.message);
+}
+
+void async::run() {
+	while (1) {
+		if (this->drain()) {
+			if (this->file != NULL) fflush(this->file);
+			if (this->console != NULL) fflush(this->console);
+			this->flushed.store(this->tail, std::memory_order_release);
+			continue;
+		}
+
+		this->flushed.store(this->tail, std::memory_order_release);
+
+		if (this->stopping.load()) break;
+		usleep(1000);
+	}
+
+	// The records which arrived after the last round
+	this->drain();
+	if (this->file != NULL) fflush(this->file);
+	if (this->console != NULL) fflush(this->console);
+}
+
+void async::flush() {
+	size_t target = this->head.load();
+	while (this->flushed.load(std::memory_order_acquire) < target && !this->stopping.load()) usleep(100);
+}
+
+async::~async() {
+	this->stopping.store(true);
+	if (this->writer.joinable()) this->writer.join();
+
+	if (instance == this) instance = NULL;
+	if (this->file != NULL) fclose(this->file);
+	delete[] this->ring;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <plog/Log.h>
+#include <plog/Appenders/IAppender.h>
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+
+namespace logger {
+
+	// Preallocated slots, a longer message or function name is truncated
+	const size_t RING_SIZE = 4096; // power of 2
+	const size_t MESSAGE_MAX = 240;
+	const size_t FUNC_MAX = 48;
+
+	struct slot_s {
+		std::atomic<size_t> sequence;
+		plog::Severity severity;
+		time_t time;
+		unsigned short millitm;
+		unsigned int tid;
+		size_t line;
+		char func[FUNC_MAX];
+		char message[MESSAGE_MAX];
+	};
+
+	// Non-blocking plog appender: the logging thread only copies the record into a lock-free
+	// ring (bounded MPMC queue, every slot has a sequence number), a background thread formats
+	// the lines like plog::TxtFormatter and writes them into the log file and the console.
+	// When the ring is full the record is dropped and counted, the logging thread never waits.
+
+	class async : public plog::IAppender {
+		private:
+			slot_s *ring;
+			std::atomic<size_t> head;     // next slot to fill (logging threads)
+			size_t tail;                  // next slot to write out (writer thread)
+			std::atomic<size_t> flushed;  // everything before this is on the disk
+			std::atomic<uint64_t> dropped;
+			uint64_t reported;
+			std::atomic<bool> stopping;
+
+			FILE *file;
+			FILE *console;
+			bool colors;
+			std::thread writer;
+
+			void run();
+			bool drain();
+			void output(slot_s &slot);
+
+		public:
+			async(const char *filename, FILE *console);
+			~async();
+
+			virtual void write(const plog::Record &record);
+
+			// Waits until every record logged before the call is written out
+			void flush();
+			uint64_t getDropped() {return this->dropped.load();};
+	};
+
+};
@@ -1,102 +1,44 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <plog/Log.h>
-#include <plog/Appenders/ColorConsoleAppender.h>
 #include <argparse.h>
 #include "i2c.h"
 #include "flash.h"
-#include "devices/rtd2660.h"
-
-void downloadFirmware(devices::device *device, std::string filename) {
-	PLOG_INFO << "Download firmware from device, enter ISP mode first";
-	device->enterISPMode();
-
-	PLOG_INFO << "Query info about the flash chip";
-
-	uint32_t flashJedecId = device->getFlashJedecID();
-	flash::device *flash = new flash::device(flashJedecId);
-
-	PLOG_INFO << "Flash device detected (jedec ID: " << std::hex << flashJedecId << " / Manufacturer: " << flash->getManufacturerName() << " / Name: " << flash->getName() << ")";
-
-	device->setFlashDevice(flash);
-
-	uint32_t startAddress = 0;
-	uint32_t endAddress = flash->getSize();
-	uint32_t size = endAddress - startAddress;
-
-	uint8_t *buffer = (uint8_t*)malloc(size);
-	if (!buffer) {
-		delete flash;
-		throw std::runtime_error("Unable to allocate memory for firmware");
-	}
-
-	size_t readed = device->readFlashContent(buffer, startAddress, size);
-
-	if (readed != size) PLOG_WARNING << "Downloaded size is not same with the flash chip size (maybe the downloaded data is corrupt)";
-
-	PLOG_INFO << "Write downloaded data into file";
-
-	FILE *fp = fopen(filename.c_str(), "wb+");
-	if (fp) {
-		fwrite(buffer, sizeof(uint8_t), size, fp);
-		fclose(fp);
-	} else PLOG_FATAL << "Unable to open the file";
-
-	PLOG_INFO << "Exit from ISP mode, the device will be restart after this";
-	device->exitISPMode();
-
-	delete flash;
-}
-
-void uploadFirmware(devices::device *device, std::string filename) {
-	PLOG_INFO << "Upload firmware to device, enter ISP mode first";
-	device->enterISPMode();
-
-	PLOG_INFO << "Query info about the flash chip";
-
-	uint32_t flashJedecId = device->getFlashJedecID();
-	flash::device *flash = new flash::device(flashJedecId);
-
-	PLOG_INFO << "Flash device detected (jedec ID: " << std::hex << flashJedecId << " / Manufacturer: " << flash->getManufacturerName() << " / Name: " << flash->getName() << ")";
-
-	device->setFlashDevice(flash);
-
-	FILE *fp = fopen(filename.c_str(), "rb");
-	if (fp) {
-
-		fseek(fp, 0L, SEEK_END);
-		size_t binarySize = ftell(fp);
-		fseek(fp, 0L, SEEK_SET);
-
-		uint8_t *buffer = (uint8_t*)malloc(binarySize);
-
-		if (buffer == NULL) {
-			fclose(fp);
-			delete flash;
-			throw std::runtime_error("Unable to allocate memory for firmware");
-		}
-
-		size_t readed = fread(buffer, sizeof(uint8_t), binarySize, fp);
-
-		if (readed == binarySize) {
-			device->writeFlashContent(buffer, 0x0, readed);
-		} else PLOG_FATAL << "The binary size and the readed size mismatch";
-
-		fclose(fp);
-	} else PLOG_FATAL << "Unable to open the file";
-
-	PLOG_INFO << "Exit from ISP mode, the device will be restart after this";
-	device->exitISPMode();
-}
+#include "scanner.h"
+#include "session.h"
+#include "server.h"
+#include "trace.h"
+#include "delta.h"
+#include "firmware.h"
+#include "planner.h"
+#include "stream.h"
+#include "logger.h"
+#include "manifest.h"
+#include "xfr.h"
+#include "layout.h"
+#include "patch.h"
+#include "bench.h"
+#include "catalogue.h"
 
 int main(int argc, char *argv[]) {
 
 	ArgumentParser parser("odc_prog");
 
 	parser.add_argument("-l", "log level (default/debug/verbose)", false);
-	parser.add_argument("-t", "Device type (rtd2660)", true);
-	parser.add_argument("-m", "Programmer mode (Available modes: download / upload)", true);
-	parser.add_argument("-f", "Binary file for upload or download", true);
-	parser.add_argument("-d", "i2c bus device ID (1 means /dev/i2c-1)", true);
+	parser.add_argument("-t", "Device type (rtd2660, rtd2662)", false);
+	parser.add_argument("-m", "Programmer mode (Available modes: download / upload / scan / daemon / delta-create / delta-upload / manifest / patch / bench / catalogue-build / identify / xfr-save / xfr-restore / xfr-diff)", true);
+	parser.add_argument("-f", "Binary file for upload or download (- means stdin/stdout)", false);
+	parser.add_argument("-d", "i2c bus device ID (1 means /dev/i2c-1) or a device name from the scan", false);
+	parser.add_argument("-a", "i2c slave address (default: 0x4a)", false);
+	parser.add_argument("-r", "Record every i2c transaction into this trace file (see odc_trace)", false);
+	parser.add_argument("-b", "Base firmware image of delta-create (the content of the device), second snapshot of xfr-diff", false);
+	parser.add_argument("-o", "Output patch file of delta-create, output catalogue of catalogue-build", false);
+	parser.add_argument("-n", "--dry-run", "Print the plan of the download / upload with the estimated duration, without running it", false);
+	parser.add_argument("-y", "Flash layout of the upload instead of -f: '<offset> <file>' lines, the gaps are blank", false);
+	parser.add_argument("-p", "Flash address of the patch mode / flash block of the bench mode", false);
+	parser.add_argument("-x", "Bytes of the patch mode in hex (e.g. 0a1b2c)", false);
+	parser.add_argument("-s", "Unix socket of the daemon mode (default: $XDG_RUNTIME_DIR/odc_prog.sock)", false);
+	parser.add_argument("-P", "--pipeline", "Upload the next flash page while the previous one is programming (run the bench mode on the controller first)", false);
 
 	try {
 		parser.parse(argc, argv);
@@ -108,47 +50,330 @@ int main(int argc, char *argv[]) {
 	if (parser.is_help()) {
 		std::cout << std::endl << "download: download firmware from the board" << std::endl
 				<< "upload: upload firmware to the board" << std::endl
-				<< "Example arguments: -d 2 -m upload -f firmware.bin" << std::endl << std::endl;
+				<< "daemon: keep the ISP sessions opened and serve jobs through a unix socket (see server.h for the protocol)" << std::endl
+				<< "delta-create: build a patch from the base image (-b) to the new image (-f) into -o, no device needed" << std::endl
+				<< "delta-upload: apply a patch (-f), only the changed flash blocks are erased and programmed" << std::endl
+				<< "patch: write the bytes of -x at the flash address -p, only the touched erase sectors are rewritten" << std::endl
+				<< "bench: read, CRC and program throughput on the flash block at -p (serialized / overlapped page upload), the block keeps its content" << std::endl
+				<< "catalogue-build: build a firmware catalogue (-o) from an index of '<name> <file>' lines (-f), no device needed" << std::endl
+				<< "identify: tell the installed firmware from a catalogue (-f) with a few hardware CRCs, without a download" << std::endl
+				<< "manifest: run the read / write / verify steps of a manifest file (-f) in one ISP session (see manifest.h)" << std::endl
+				<< "xfr-save / xfr-restore: snapshot the scaler registers into -f / write back the differing ones, the monitor keeps running" << std::endl
+				<< "xfr-diff: compare two register snapshots (-f and -b), no device needed" << std::endl
+				<< "scan: look for display controllers on every i2c bus, the found devices can be used by name with -d" << std::endl
+				<< "--dry-run: with a device name from the scan the device is not touched, with a bus number it is only probed" << std::endl
+				<< "Example arguments: -d 2 -m upload -f firmware.bin" << std::endl
+				<< "Partitions: -d 2 -m upload -y flash.layout (see layout.h)" << std::endl
+				<< "Serial number: -d 2 -m patch -p 0x3f000 -x 4f44433031" << std::endl
+				<< "Streaming: -d 2 -m download -f - | xz > firmware.bin.xz" << std::endl << std::endl;
 		return 0;
 	}
 
-	static plog::ColorConsoleAppender<plog::TxtFormatter> consoleAppender;
-	plog::init(plog::info, "programmer.log").addAppender(&consoleAppender);
-
-	int i2cID = parser.get<int>("d");
+	std::string deviceName = parser.get<std::string>("d");
+	std::string address = parser.get<std::string>("a");
+	std::string socketPath = parser.get<std::string>("s");
+	std::string baseFile = parser.get<std::string>("b");
+	std::string outputFile = parser.get<std::string>("o");
+	std::string traceFile = parser.get<std::string>("r");
 	std::string level = parser.get<std::string>("l");
 	std::string deviceType = parser.get<std::string>("t");
 	std::string file = parser.get<std::string>("f");
+	std::string layoutFile = parser.get<std::string>("y");
+	std::string patchAddress = parser.get<std::string>("p");
+	std::string patchBytes = parser.get<std::string>("x");
 	std::string mode = parser.get<std::string>("m");
+	bool dryRun = parser.exists("n");
+	bool pipeline = parser.exists("P");
+
+	// When the firmware goes to stdout, the console log must not be mixed into it.
+	// The lines are written by a background thread, logging never stalls the bus
+	static logger::async logAppender("programmer.log", file == "-" && mode == "download" ? stderr : stdout);
+	plog::init(plog::info, &logAppender);
 
 	if (level == "" | level == "info") plog::get()->setMaxSeverity(plog::info);
 	else if (level == "debug") plog::get()->setMaxSeverity(plog::debug);
 	else if (level == "verbose") plog::get()->setMaxSeverity(plog::verbose);
 
-	i2c::connection *conn = NULL;
+	uint8_t i2cAddress = scanner::DEFAULT_ADDRESS;
+	if (address != "") i2cAddress = strtol(address.c_str(), NULL, 0);
+
+	if (mode == "scan") {
+		std::vector<uint8_t> addresses(1, i2cAddress);
+		std::vector<scanner::result_s> results = scanner::scan(addresses, scanner::TIME_BUDGET_MS);
+		logAppender.flush();
+		scanner::printTable(results);
+		scanner::saveCache(results);
+		return 0;
+	}
+
+	if (mode == "daemon") {
+		if (deviceType == "") deviceType = "rtd2660";
+		if (socketPath == "") socketPath = server::defaultSocketPath();
+
+		try {
+			server::daemon daemon(socketPath, deviceType, i2cAddress);
+			daemon.run();
+		} catch(std::exception& e) {
+			PLOG_FATAL << "daemon: " << std::string(e.what());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "catalogue-build") {
+		if (file == "" || outputFile == "") {
+			PLOG_FATAL << "The -f and -o arguments are required in " << mode << " mode";
+			return 1;
+		}
+
+		try {
+			catalogue::catalogue_s result;
+			catalogue::build(file, result);
+			catalogue::save(outputFile, result);
+		} catch(catalogue::exception& e) {
+			PLOG_FATAL << "catalogue exception: " << std::string(e.what());
+			return 1;
+		} catch(layout::exception& e) {
+			PLOG_FATAL << "layout exception: " << std::string(e.what());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "delta-create") {
+		if (baseFile == "" || file == "" || outputFile == "") {
+			PLOG_FATAL << "The -b, -f and -o arguments are required in " << mode << " mode";
+			return 1;
+		}
+
+		try {
+			std::vector<uint8_t> base, target;
+			delta::readImage(baseFile, base);
+			delta::readImage(file, target);
+
+			delta::patch_s patch;
+			delta::create(base, target, delta::DEFAULT_BLOCK_SIZE, patch);
+			delta::save(outputFile, patch);
+		} catch(delta::exception& e) {
+			PLOG_FATAL << "delta exception: " << std::string(e.what());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "xfr-diff") {
+		try {
+			xfr::snapshot_s a, b;
+			xfr::load(file, a);
+			xfr::load(baseFile, b);
+			xfr::diff(a, b);
+		} catch(xfr::exception& e) {
+			PLOG_FATAL << "xfr exception: " << std::string(e.what());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "patch" && (patchAddress == "" || patchBytes == "")) {
+		PLOG_FATAL << "The -p and -x arguments are required in " << mode << " mode";
+		return 1;
+	}
+
+	if (mode == "bench" && patchAddress == "") {
+		PLOG_FATAL << "The -p argument is required in " << mode << " mode";
+		return 1;
+	}
+
+	// The dry run of a download, the patch and the bench need no file
+	if (deviceName == "" || deviceType == "" || (file == "" && !(dryRun && mode == "download") && !(layoutFile != "" && mode == "upload") && mode != "patch" && mode != "bench")) {
+		PLOG_FATAL << "The -d, -t and -f (or -y in upload mode) arguments are required in " << mode << " mode";
+		return 1;
+	}
+
+	// The device is a bus number, or a name from the last scan
+	int i2cID;
+	if (deviceName.find_first_not_of("0123456789") == std::string::npos) {
+		i2cID = atoi(deviceName.c_str());
+	} else {
+		scanner::result_s cached;
+		if (!scanner::lookup(deviceName, cached)) {
+			PLOG_FATAL << "Unknown device name: " << deviceName << " (run the scan mode first)";
+			return 1;
+		}
+		i2cID = cached.adapter;
+		if (address == "") i2cAddress = cached.address;
+		PLOG_INFO << "Using " << deviceName << " (i2c-" << i2cID << ", " << cached.flashName << ")";
+
+		// The scan already knows the flash, the plan can be made without the device
+		if (dryRun && (mode == "download" || mode == "upload")) {
+			try {
+				planner::model_s model;
+				planner::loadModel(model);
+				flash::device flash(cached.jedecId);
+
+				layout::image image;
+				std::vector<planner::plan_s> plans;
+				if (mode == "upload") {
+					if (layoutFile != "") layout::load(layoutFile, image);
+					else planner::loadImage(file, &flash, image);
+					plans = planner::planUpload(model, &flash, model.transferSize, image);
+				} else plans = planner::planDownload(model, &flash, model.transferSize);
+
+				logAppender.flush();
+				planner::print(plans);
+			} catch(planner::exception& e) {
+				PLOG_FATAL << "planner exception: " << std::string(e.what());
+				return 1;
+			} catch(stream::exception& e) {
+				PLOG_FATAL << "stream exception: " << std::string(e.what());
+				return 1;
+			} catch(layout::exception& e) {
+				PLOG_FATAL << "layout exception: " << std::string(e.what());
+				return 1;
+			} catch(std::exception& e) {
+				PLOG_FATAL << "std::exception: " << std::string(e.what());
+				return 1;
+			}
+			return 0;
+		}
+	}
+
+	isp::session *session = NULL;
 	try {
-		conn = new i2c::connection(i2cID, 0x4A);
+		session = new isp::session(i2cID, i2cAddress, deviceType);
 	} catch(i2c::exception& e) {
 		PLOG_FATAL << "i2c exception: " << std::string(e.what());
 		return 1;
-	}
-
-	devices::device *device = NULL;
-	if (deviceType == "rtd2660") device = new devices::rtd2660(conn);
-	else {
-		PLOG_FATAL << "Unknown device: " << deviceType;
-		delete conn;
+	} catch(devices::exception& e) {
+		PLOG_FATAL << std::string(e.what());
 		return 1;
 	}
 
+	if (pipeline) session->getDevice()->setProgramPipeline(true);
+
+	trace::recorder *recorder = NULL;
+
 	try {
-		if (mode == "download") downloadFirmware(device, file);
-		else if (mode == "upload") uploadFirmware(device, file);
-		else PLOG_FATAL << "Unknown mode: " << mode;
+		if (traceFile != "") {
+			recorder = new trace::recorder(traceFile, i2cID, i2cAddress);
+			session->getConnection()->setRecorder(recorder);
+		}
+
+		if (mode == "download" || mode == "upload") {
+			PLOG_INFO << (mode == "download" ? "Download firmware from device" : "Upload firmware to device");
+
+			planner::model_s model;
+			planner::loadModel(model);
+
+			session->open();
+			model.transferSize = session->getConnection()->getMaxTransferSize();
+			model.writeSize = session->getConnection()->getMaxWriteSize();
+
+			layout::image image;
+			std::vector<planner::plan_s> plans;
+			bool streamed = (mode == "upload" && layoutFile == "" && !dryRun && !stream::isRegular(file));
+			if (mode == "upload" && !streamed) {
+				if (layoutFile != "") layout::load(layoutFile, image);
+				else planner::loadImage(file, session->getFlash(), image);
+				plans = planner::planUpload(model, session->getFlash(), model.transferSize, image);
+			} else if (mode == "download") plans = planner::planDownload(model, session->getFlash(), model.transferSize);
+
+			if (streamed) {
+				// A pipe is consumed once and may be larger than the memory, it is uploaded window by window without a plan
+				PLOG_INFO << "The input is a stream, upload it block by block";
+				firmware::upload(session, file);
+			} else if (dryRun) {
+				logAppender.flush();
+				planner::print(plans);
+				planner::saveModel(model);
+			} else if (mode == "upload") planner::executeUpload(session, plans[0], image, model);
+			else planner::executeDownload(session, plans[0], file, model);
+
+			session->close();
+		} else if (mode == "delta-upload") {
+			PLOG_INFO << "Upload firmware patch to device";
+			delta::patch_s patch;
+			delta::load(file, patch);
+			session->open();
+			delta::apply(session, patch);
+			session->close();
+		} else if (mode == "xfr-save" || mode == "xfr-restore") {
+			// No ISP mode here, the registers of the running firmware are wanted
+			devices::rtd2660 *rtd2660 = dynamic_cast<devices::rtd2660*>(session->getDevice());
+			devices::rtd2662 *rtd2662 = dynamic_cast<devices::rtd2662*>(session->getDevice());
+			if (rtd2660 == NULL && rtd2662 == NULL) throw xfr::exception("The device hasnt got a scaler interface");
+
+			xfr::snapshot_s snapshot;
+			if (mode == "xfr-save") {
+				if (rtd2660 != NULL) xfr::capture(rtd2660, snapshot);
+				else xfr::capture(rtd2662, snapshot);
+				xfr::save(file, snapshot);
+				PLOG_INFO << "Scaler registers saved into " << file;
+			} else {
+				xfr::load(file, snapshot);
+				if (rtd2660 != NULL) xfr::restore(rtd2660, snapshot);
+				else xfr::restore(rtd2662, snapshot);
+			}
+		} else if (mode == "patch") {
+			std::vector<uint8_t> data = patch::parseBytes(patchBytes);
+			char *end;
+			unsigned long address = strtoul(patchAddress.c_str(), &end, 0);
+			if (*end != 0 || address > 0xFFFFFFFFul) throw patch::exception("Invalid patch address: " + patchAddress);
+
+			session->open();
+			patch::write(session, address, &data[0], data.size());
+			session->close();
+		} else if (mode == "identify") {
+			catalogue::catalogue_s known;
+			catalogue::load(file, known);
+
+			session->open();
+			catalogue::match_s match = catalogue::identify(session, known);
+			session->close();
+
+			logAppender.flush();
+			catalogue::print(known, match);
+		} else if (mode == "bench") {
+			char *end;
+			unsigned long address = strtoul(patchAddress.c_str(), &end, 0);
+			if (*end != 0 || address > 0xFFFFFFFFul) throw bench::exception("Invalid block address: " + patchAddress);
+
+			session->open();
+			bench::result_s result = bench::run(session, address);
+			session->close();
+
+			logAppender.flush();
+			bench::print(result);
+		} else if (mode == "manifest") {
+			std::vector<manifest::step_s> steps = manifest::load(file);
+			session->open();
+			manifest::run(session, steps);
+			session->close();
+		} else PLOG_FATAL << "Unknown mode: " << mode;
 	} catch(devices::exception& e) {
 		PLOG_FATAL << "device exception: " << std::string(e.what());
 	} catch(i2c::exception& e) {
 		PLOG_FATAL << "i2c exception: " << std::string(e.what());
+	} catch(stream::exception& e) {
+		PLOG_FATAL << "stream exception: " << std::string(e.what());
+	} catch(trace::exception& e) {
+		PLOG_FATAL << "trace exception: " << std::string(e.what());
+	} catch(delta::exception& e) {
+		PLOG_FATAL << "delta exception: " << std::string(e.what());
+	} catch(planner::exception& e) {
+		PLOG_FATAL << "planner exception: " << std::string(e.what());
+	} catch(manifest::exception& e) {
+		PLOG_FATAL << "manifest exception: " << std::string(e.what());
+	} catch(xfr::exception& e) {
+		PLOG_FATAL << "xfr exception: " << std::string(e.what());
+	} catch(layout::exception& e) {
+		PLOG_FATAL << "layout exception: " << std::string(e.what());
+	} catch(patch::exception& e) {
+		PLOG_FATAL << "patch exception: " << std::string(e.what());
+	} catch(bench::exception& e) {
+		PLOG_FATAL << "bench exception: " << std::string(e.what());
+	} catch(catalogue::exception& e) {
+		PLOG_FATAL << "catalogue exception: " << std::string(e.what());
 	} catch(std::exception& e) {
 		PLOG_FATAL << "std::exception: " << std::string(e.what());
 	} catch(...) {
@@ -156,7 +381,8 @@ int main(int argc, char *argv[]) {
 		PLOG_FATAL << "Unknown exception: " << (p ? p.__cxa_exception_type()->name() : "null");
 	}
 
-	delete device;
-	delete conn;
+	session->getConnection()->setRecorder(NULL);
+	delete recorder;
+	delete session;
 
 }
@@ -0,0 +1,231 @@
+#include <plog/Log.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+
+#include "manifest.h"
+#include "stream.h"
+
+using namespace manifest;
+
+static std::string lineError(step_s &step, std::string message) {
+	std::stringstream msg;
+	msg << "line " << step.line << ": " << message;
+	return msg.str();
+}
+
+static uint32_t parseNumber(std::string value, int line) {
+	char *end;
+	unsigned long result = strtoul(value.c_str(), &end, 0);
+	if (value.empty() || *end != 0) {
+		std::stringstream msg;
+		msg << "line " << line << ": invalid number: " << value;
+		throw manifest::exception(msg.str());
+	}
+	return result;
+}
+
+std::vector<step_s> manifest::load(std::string filename) {
+	std::ifstream file(filename.c_str());
+	if (!file) throw manifest::exception("Unable to open the manifest: " + filename);
+
+	std::string directory;
+	size_t slash = filename.rfind('/');
+	if (slash != std::string::npos) directory = filename.substr(0, slash + 1);
+
+	std::vector<step_s> steps;
+	std::string line;
+	int number = 0;
+
+	while (std::getline(file, line)) {
+		number++;
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line = line.substr(0, comment);
+
+		std::istringstream tokens(line);
+		std::string type, address, size;
+
+		if (!(tokens >> type)) continue;
+
+		step_s step;
+		step.line = number;
+		step.size = 0;
+
+		if (type == "read") {
+			step.type = step_read;
+			tokens >> address >> size >> step.filename;
+			step.size = parseNumber(size, number);
+		} else if (type == "write" || type == "verify") {
+			step.type = (type == "write") ? step_write : step_verify;
+			tokens >> address >> step.filename;
+		} else throw manifest::exception(lineError(step, "unknown step: " + type));
+
+		if (step.filename == "") throw manifest::exception(lineError(step, "missing arguments"));
+		step.address = parseNumber(address, number);
+
+		if (step.filename[0] != '/') step.filename = directory + step.filename;
+
+		if (step.type != step_read) {
+			struct stat st;
+			if (stat(step.filename.c_str(), &st) < 0) throw manifest::exception(lineError(step, "unable to open " + step.filename));
+			step.size = st.st_size;
+		}
+
+		steps.push_back(step);
+	}
+
+	return steps;
+}
+
+static void readFile(step_s &step, std::vector<uint8_t> &data) {
+	stream::file input(step.filename, false);
+	data.resize(step.size);
+	if (input.read(&data[0], data.size()) != data.size()) throw manifest::exception(lineError(step, "short read from " + step.filename));
+}
+
+// Content of one block after every write step: the kept bytes, then the writes in their order
+static void rewriteBlock(devices::device *device, std::vector<step_s> &steps, std::vector<std::vector<uint8_t> > &data,
+		uint32_t block, size_t last, uint32_t blockSize, std::vector<uint8_t> &content) {
+	std::vector<bool> covered(blockSize, false);
+	size_t coveredBytes = 0;
+
+	for (size_t i = 0; i <= last; i++) {
+		if (steps[i].type != step_write) continue;
+		for (uint32_t address = std::max(block, steps[i].address); address < std::min(block + blockSize, steps[i].address + steps[i].size); address++) {
+			if (!covered[address - block]) coveredBytes++;
+			covered[address - block] = true;
+		}
+	}
+
+	std::vector<uint8_t> original;
+	content.assign(blockSize, 0xFF);
+
+	// Read-modify-write only when some of the bytes are kept
+	if (coveredBytes < blockSize) {
+		original.resize(blockSize);
+		device->readFlashContent(&original[0], block, blockSize);
+		for (uint32_t i = 0; i < blockSize; i++) if (!covered[i]) content[i] = original[i];
+	}
+
+	for (size_t i = 0; i <= last; i++) {
+		if (steps[i].type != step_write) continue;
+		for (uint32_t address = std::max(block, steps[i].address); address < std::min(block + blockSize, steps[i].address + steps[i].size); address++) {
+			content[address - block] = data[i][address - steps[i].address];
+		}
+	}
+
+	if (content == original) {
+		PLOG_INFO << "Block at 0x" << std::hex << block << " already holds the written content";
+		return;
+	}
+
+	device->eraseFlashBlock(block);
+	device->programFlashContent(&content[0], block, blockSize, true);
+}
+
+void manifest::run(isp::session *session, std::vector<step_s> &steps) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	uint32_t blockSize = flash->getBlockSize();
+
+	// The first and the last write step of every block
+	std::map<uint32_t, size_t> firstWrite, lastWrite;
+
+	for (size_t i = 0; i < steps.size(); i++) {
+		step_s &step = steps[i];
+		if (step.size == 0) throw manifest::exception(lineError(step, "empty range"));
+		if ((uint64_t)step.address + step.size > flash->getSize()) throw manifest::exception(lineError(step, "the range is out of the flash"));
+
+		if (step.type != step_write) continue;
+		for (uint32_t block = step.address - step.address % blockSize; block < step.address + step.size; block += blockSize) {
+			if (firstWrite.count(block) == 0) firstWrite[block] = i;
+			lastWrite[block] = i;
+		}
+	}
+
+	// A block is rewritten once, at its last write: it can't be inspected between its writes
+	for (size_t i = 0; i < steps.size(); i++) {
+		step_s &step = steps[i];
+		if (step.type == step_write) continue;
+
+		for (uint32_t block = step.address - step.address % blockSize; block < step.address + step.size; block += blockSize) {
+			if (lastWrite.count(block) == 0 || lastWrite[block] < i) continue;
+
+			std::stringstream msg;
+			if (step.type == step_verify) msg << "the block at 0x" << std::hex << block << " is written by a later step (verify runs in the final pass)";
+			else if (firstWrite[block] < i) msg << "the block at 0x" << std::hex << block << " is between its writes (it is rewritten at line " << std::dec << steps[lastWrite[block]].line << ")";
+			else continue;
+
+			throw manifest::exception(lineError(step, msg.str()));
+		}
+	}
+
+	if (!lastWrite.empty() && flash->getOpCode_blockErase() == -1) throw manifest::exception("The flash chip hasnt got block erase support, the manifest can't write");
+
+	// Every write is loaded before the flash is touched
+	std::vector<std::vector<uint8_t> > data(steps.size());
+	for (size_t i = 0; i < steps.size(); i++) {
+		if (steps[i].type == step_write) readFile(steps[i], data[i]);
+	}
+
+	std::map<uint32_t, std::vector<uint8_t> > written;
+	bool writing = false;
+
+	for (size_t i = 0; i < steps.size(); i++) {
+		step_s &step = steps[i];
+
+		if (step.type == step_read) {
+			PLOG_INFO << "Step " << std::dec << step.line << ": read " << step.size << " byte from 0x" << std::hex << step.address << " into " << step.filename;
+
+			stream::file output(step.filename, true);
+			std::vector<uint8_t> buffer(blockSize);
+
+			for (uint32_t address = step.address; address < step.address + step.size; address += blockSize) {
+				uint32_t size = std::min(blockSize, step.address + step.size - address);
+				device->readFlashContent(&buffer[0], address, size);
+				output.write(&buffer[0], size);
+			}
+		} else if (step.type == step_write) {
+			PLOG_INFO << "Step " << std::dec << step.line << ": write " << step.filename << " (" << step.size << " byte) to 0x" << std::hex << step.address;
+
+			for (std::map<uint32_t, size_t>::iterator it = lastWrite.begin(); it != lastWrite.end(); ++it) {
+				if (it->second != i) continue;
+
+				if (!writing) {
+					device->beginFlashWrite(false);
+					writing = true;
+				}
+				rewriteBlock(device, steps, data, it->first, i, blockSize, written[it->first]);
+			}
+		}
+	}
+
+	if (writing) device->endFlashWrite();
+
+	PLOG_INFO << "Final verification";
+
+	for (std::map<uint32_t, std::vector<uint8_t> >::iterator it = written.begin(); it != written.end(); ++it) {
+		device->verifyFlashContent(&it->second[0], it->first, blockSize);
+	}
+
+	for (size_t i = 0; i < steps.size(); i++) {
+		step_s &step = steps[i];
+		if (step.type != step_verify) continue;
+
+		PLOG_INFO << "Step " << std::dec << step.line << ": verify " << step.filename << " at 0x" << std::hex << step.address;
+
+		std::vector<uint8_t> content;
+		readFile(step, content);
+
+		for (uint32_t offset = 0; offset < step.size; offset += blockSize) {
+			device->verifyFlashContent(&content[offset], step.address + offset, std::min(blockSize, step.size - offset));
+		}
+	}
+
+	PLOG_INFO << "Manifest done (" << std::dec << steps.size() << " step(s), " << written.size() << " block(s) written)";
+}
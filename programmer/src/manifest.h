@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+
+namespace manifest {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Manifest: one step per line, '#' starts a comment, the numbers can be hex (0x...)
+		The relative file names are relative to the manifest.
+
+			read   <address> <size> <file>   save a flash range into a file
+			write  <address> <file>          write a file into the flash
+			verify <address> <file>          check a flash range against a file
+
+		All of the steps run in one ISP session. Every flash block is erased once, when the
+		last write step touching it runs (the bytes outside of the writes are kept), and the
+		writes and the verify steps are checked in one final CRC pass.
+	*/
+
+	enum type_e {
+		step_read,
+		step_write,
+		step_verify
+	};
+
+	struct step_s {
+		type_e type;
+		uint32_t address;
+		uint32_t size;        // read: requested / write, verify: size of the file
+		std::string filename;
+		int line;
+	};
+
+	std::vector<step_s> load(std::string filename);
+	void run(isp::session *session, std::vector<step_s> &steps);
+
+};
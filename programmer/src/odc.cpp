@@ -0,0 +1,274 @@
+#include <plog/Log.h>
+#include <plog/Appenders/IAppender.h>
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include "odc.h"
+#include "session.h"
+#include "patch.h"
+
+struct odc_handle {
+	isp::session *session;
+	std::string error;
+};
+
+// Failures found by the library itself, before the device is touched
+class status_error {
+	public:
+		status_error(int s, const std::string m):status(s),msg(m){};
+		int status;
+		std::string msg;
+};
+
+template <typename F> static int guard(odc_handle *handle, F body) {
+	if (handle == NULL) return ODC_ERR_ARGUMENT;
+
+	int status = ODC_OK;
+	handle->error.clear();
+
+	try {
+		body();
+	} catch (status_error &e) {
+		status = e.status;
+		handle->error = e.msg;
+	} catch (i2c::exception &e) {
+		status = ODC_ERR_I2C;
+		handle->error = e.what();
+	} catch (devices::exception &e) {
+		status = ODC_ERR_DEVICE;
+		handle->error = e.what();
+	} catch (devices::exception *e) {
+		status = ODC_ERR_DEVICE;
+		handle->error = e->what();
+		delete e;
+	} catch (patch::exception &e) {
+		status = ODC_ERR_DEVICE;
+		handle->error = e.what();
+	} catch (std::exception &e) {
+		status = ODC_ERR_UNKNOWN;
+		handle->error = e.what();
+	} catch (...) {
+		status = ODC_ERR_UNKNOWN;
+		handle->error = "unknown error";
+	}
+
+	if (status != ODC_OK) PLOG_ERROR << "[odc] " << handle->error;
+
+	return status;
+}
+
+// Reason of the last failed odc_open of the thread, there is no handle to keep it
+static thread_local std::string openError;
+
+static isp::session *openedSession(odc_handle *handle) {
+	if (!handle->session->isOpened()) throw status_error(ODC_ERR_STATE, "The device isnt in ISP mode");
+	return handle->session;
+}
+
+int odc_api_version(void) {
+	return ODC_API_VERSION;
+}
+
+int odc_open(int adapter, uint8_t address, const char *deviceType, odc_handle **handle) {
+	if (handle == NULL || deviceType == NULL) {
+		openError = "invalid argument";
+		return ODC_ERR_ARGUMENT;
+	}
+
+	odc_handle *result = new odc_handle();
+	result->session = NULL;
+
+	int status = guard(result, [&]() {
+		result->session = new isp::session(adapter, address, deviceType);
+	});
+
+	openError = result->error;
+
+	if (status != ODC_OK) {
+		delete result;
+		*handle = NULL;
+		return status;
+	}
+
+	*handle = result;
+	return ODC_OK;
+}
+
+int odc_close(odc_handle *handle) {
+	if (handle == NULL) return ODC_ERR_ARGUMENT;
+
+	int status = guard(handle, [&]() {
+		handle->session->close();
+	});
+
+	delete handle->session;
+	delete handle;
+
+	return status;
+}
+
+const char *odc_last_error(odc_handle *handle) {
+	if (handle == NULL) return openError.empty() ? "invalid handle" : openError.c_str();
+	return handle->error.c_str();
+}
+
+int odc_isp_enter(odc_handle *handle) {
+	return guard(handle, [&]() {
+		handle->session->open();
+	});
+}
+
+int odc_isp_exit(odc_handle *handle) {
+	return guard(handle, [&]() {
+		handle->session->close();
+	});
+}
+
+int odc_flash_get_info(odc_handle *handle, odc_flash_info *info) {
+	return guard(handle, [&]() {
+		if (info == NULL) throw status_error(ODC_ERR_ARGUMENT, "No info structure");
+
+		flash::device *flash = openedSession(handle)->getFlash();
+
+		memset(info, 0, sizeof(odc_flash_info));
+		info->jedecId = flash->getJedecId();
+		info->size = flash->getSize();
+		info->blockSize = flash->getBlockSize();
+		info->pageSize = flash->getPageSize();
+		strncpy(info->name, flash->getName().c_str(), sizeof(info->name) - 1);
+		strncpy(info->manufacturer, flash->getManufacturerName().c_str(), sizeof(info->manufacturer) - 1);
+	});
+}
+
+int odc_flash_crc(odc_handle *handle, uint32_t startAddress, uint32_t endAddress, uint8_t *crc) {
+	return guard(handle, [&]() {
+		isp::session *session = openedSession(handle);
+
+		if (crc == NULL || startAddress > endAddress || endAddress >= session->getFlash()->getSize()) {
+			throw status_error(ODC_ERR_ARGUMENT, "Invalid CRC range");
+		}
+
+		*crc = session->getDevice()->calculateCRC(startAddress, endAddress);
+	});
+}
+
+static void checkRanges(flash::device *flash, odc_range *ranges, size_t count) {
+	uint32_t blockSize = flash->getBlockSize();
+
+	for (size_t i = 0; i < count; i++) {
+		odc_range &range = ranges[i];
+		std::string reason;
+
+		if (range.op != ODC_OP_READ && range.op != ODC_OP_WRITE && range.op != ODC_OP_VERIFY) reason = "unknown operation";
+		else if (range.buffer == NULL || range.size == 0) reason = "empty range";
+		else if ((uint64_t)range.address + range.size > flash->getSize()) reason = "the range is out of the flash";
+		else if (range.op == ODC_OP_WRITE && (range.address % blockSize != 0 || range.size % blockSize != 0)) reason = "the write isnt erase block aligned";
+		else if (range.op == ODC_OP_WRITE && flash->getOpCode_blockErase() == -1) reason = "the flash chip hasnt got block erase support";
+
+		if (!reason.empty()) throw status_error(ODC_ERR_ARGUMENT, "Range " + std::to_string(i) + ": " + reason);
+	}
+}
+
+static void runBatch(isp::session *session, odc_range *ranges, size_t count, odc_progress_cb progress, void *user, bool &writing) {
+	devices::device *device = session->getDevice();
+	uint32_t blockSize = session->getFlash()->getBlockSize();
+
+	for (size_t i = 0; i < count; i++) {
+		odc_range &range = ranges[i];
+
+		// Block by block, straight from / into the buffer of the caller
+		for (uint32_t done = 0; done < range.size;) {
+			uint32_t address = range.address + done;
+			uint32_t size = std::min(blockSize - address % blockSize, range.size - done);
+			uint8_t *buffer = range.buffer + done;
+
+			if (range.op == ODC_OP_READ) {
+				device->readFlashContent(buffer, address, size);
+			} else if (range.op == ODC_OP_WRITE) {
+				if (!writing) {
+					device->beginFlashWrite(false);
+					writing = true;
+				}
+				device->eraseFlashBlock(address);
+				device->programFlashContent(buffer, address, size, true);
+				device->verifyFlashContent(buffer, address, size);
+			} else {
+				device->verifyFlashContent(buffer, address, size);
+			}
+
+			done += size;
+
+			if (progress != NULL && progress(user, i, done, range.size) != 0) {
+				throw status_error(ODC_ERR_CANCELLED, "The batch is cancelled at range " + std::to_string(i));
+			}
+		}
+	}
+}
+
+int odc_flash_batch(odc_handle *handle, odc_range *ranges, size_t count, odc_progress_cb progress, void *user) {
+	return guard(handle, [&]() {
+		isp::session *session = openedSession(handle);
+		if (ranges == NULL && count != 0) throw status_error(ODC_ERR_ARGUMENT, "No ranges");
+
+		// Every range is checked before the flash is touched
+		checkRanges(session->getFlash(), ranges, count);
+
+		bool writing = false;
+
+		try {
+			runBatch(session, ranges, count, progress, user, writing);
+		} catch (...) {
+			// The protection is restored even if the batch failed halfway
+			if (writing) {
+				try {
+					session->getDevice()->endFlashWrite();
+				} catch (...) {}
+			}
+			throw;
+		}
+
+		if (writing) session->getDevice()->endFlashWrite();
+	});
+}
+
+int odc_flash_patch(odc_handle *handle, uint32_t address, const uint8_t *data, uint32_t size) {
+	return guard(handle, [&]() {
+		isp::session *session = openedSession(handle);
+
+		if (data == NULL || size == 0 || (uint64_t)address + size > session->getFlash()->getSize()) {
+			throw status_error(ODC_ERR_ARGUMENT, "Invalid patch range");
+		}
+
+		patch::write(session, address, data, size);
+	});
+}
+
+int odc_set_program_pipeline(odc_handle *handle, int enabled) {
+	return guard(handle, [&]() {
+		handle->session->getDevice()->setProgramPipeline(enabled != 0);
+	});
+}
+
+class callbackAppender : public plog::IAppender {
+	public:
+		odc_log_cb callback;
+		void *user;
+
+		virtual void write(const plog::Record &record) {
+			if (this->callback != NULL) this->callback(this->user, record.getSeverity(), record.getMessage());
+		}
+};
+
+void odc_set_log_callback(odc_log_cb callback, void *user, int maxSeverity) {
+	static callbackAppender appender;
+	static bool initialized = false;
+
+	appender.callback = callback;
+	appender.user = user;
+
+	if (!initialized) {
+		plog::init((plog::Severity)maxSeverity, &appender);
+		initialized = true;
+	} else plog::get()->setMaxSeverity((plog::Severity)maxSeverity);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+	libodc: C interface of the programmer
+
+	Every call returns ODC_OK or a negative status, odc_last_error() tells the reason.
+	The buffers are owned by the caller, the library never allocates an image sized buffer.
+	One handle is one controller on one bus, a handle must not be used from two threads at once.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ODC_API_VERSION 2
+
+/* The library is built with hidden symbols, only the functions below are exported */
+#if defined(__GNUC__)
+#define ODC_API __attribute__((visibility("default")))
+#else
+#define ODC_API
+#endif
+
+enum odc_status {
+	ODC_OK             = 0,
+	ODC_ERR_ARGUMENT   = -1,  /* invalid handle, range or alignment */
+	ODC_ERR_I2C        = -2,  /* the adapter or the bus failed */
+	ODC_ERR_DEVICE     = -3,  /* the controller or the flash failed, CRC mismatch included */
+	ODC_ERR_STATE      = -4,  /* the call needs the ISP mode (odc_isp_enter) */
+	ODC_ERR_CANCELLED  = -5,  /* the progress callback returned non-zero */
+	ODC_ERR_UNKNOWN    = -99
+};
+
+enum odc_op {
+	ODC_OP_READ   = 0,  /* flash -> buffer, CRC checked */
+	ODC_OP_WRITE  = 1,  /* buffer -> flash, erase block aligned address and size, CRC checked */
+	ODC_OP_VERIFY = 2   /* CRC of the flash range against the buffer */
+};
+
+typedef struct odc_handle odc_handle;
+
+typedef struct {
+	int op;             /* odc_op */
+	uint32_t address;
+	uint32_t size;
+	uint8_t *buffer;    /* size byte, owned by the caller */
+} odc_range;
+
+typedef struct {
+	uint32_t jedecId;
+	uint32_t size;
+	uint32_t blockSize;
+	uint32_t pageSize;
+	char name[32];
+	char manufacturer[32];
+} odc_flash_info;
+
+/* Called after every block of a batch, return non-zero to stop the batch */
+typedef int (*odc_progress_cb)(void *user, size_t range, uint32_t done, uint32_t total);
+
+/* Log lines of the library (plog severities: 1 fatal ... 6 verbose) */
+typedef void (*odc_log_cb)(void *user, int severity, const char *message);
+
+ODC_API int odc_api_version(void);
+
+/* Without a handle (NULL) odc_last_error tells why the last odc_open of the calling thread failed */
+ODC_API int odc_open(int adapter, uint8_t address, const char *deviceType, odc_handle **handle);
+ODC_API int odc_close(odc_handle *handle);
+ODC_API const char *odc_last_error(odc_handle *handle);
+
+/* Enter the ISP mode and set up the flash / exit it (the monitor restarts) */
+ODC_API int odc_isp_enter(odc_handle *handle);
+ODC_API int odc_isp_exit(odc_handle *handle);
+
+ODC_API int odc_flash_get_info(odc_handle *handle, odc_flash_info *info);
+ODC_API int odc_flash_crc(odc_handle *handle, uint32_t startAddress, uint32_t endAddress, uint8_t *crc);
+
+/* Runs the ranges in their order, the writes of one batch share one unprotect / protect cycle */
+ODC_API int odc_flash_batch(odc_handle *handle, odc_range *ranges, size_t count, odc_progress_cb progress, void *user);
+
+/* Byte granular write: only the erase sectors of the range are read back and rewritten (since version 2) */
+ODC_API int odc_flash_patch(odc_handle *handle, uint32_t address, const uint8_t *data, uint32_t size);
+
+/* Upload of the next page while the previous one is programming, off by default (since version 2).
+   The first overlap of a write is CRC checked, a failed check switches it off with ODC_ERR_DEVICE. */
+ODC_API int odc_set_program_pipeline(odc_handle *handle, int enabled);
+
+/*
+	The library logs through this callback. Its plog instance is its own (the symbols are hidden),
+	a C++ host which uses plog forwards the lines into its own logger from here.
+*/
+ODC_API void odc_set_log_callback(odc_log_cb callback, void *user, int maxSeverity);
+
+#ifdef __cplusplus
+}
+#endif
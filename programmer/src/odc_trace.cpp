@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ColorConsoleAppender.h>
+#include <argparse.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "trace.h"
+#include "simulator.h"
+#include "devices/rtd2660.h"
+
+// Key of the per-register statistics: op << 8 | register
+typedef std::map<uint16_t, std::pair<uint64_t, uint64_t> > usage_t; // count, ns
+
+struct summary_s {
+	uint64_t records;
+	uint64_t failed;
+	uint64_t bytes;
+	uint64_t busTime;
+	uint64_t wallTime;
+	usage_t usage;
+};
+
+static void summarize(std::string filename, summary_s &summary, std::vector<trace::record_s> *records) {
+	trace::reader reader(filename);
+	trace::record_s record;
+
+	summary.records = summary.failed = summary.bytes = summary.busTime = summary.wallTime = 0;
+
+	while (reader.next(record)) {
+		summary.records++;
+		if (record.status != trace::status_ok) summary.failed++;
+		summary.bytes += record.payload.size();
+		summary.busTime += record.duration;
+		summary.wallTime = record.start + record.duration;
+
+		std::pair<uint64_t, uint64_t> &usage = summary.usage[(record.op << 8) | record.reg];
+		usage.first++;
+		usage.second += record.duration;
+
+		if (records != NULL) records->push_back(record);
+	}
+}
+
+static void dump(std::string filename) {
+	trace::reader reader(filename);
+	trace::record_s record;
+	uint64_t index = 0;
+
+	printf("# adapter i2c-%d, address 0x%02x\n", reader.adapter, reader.address);
+	printf("%8s %12s %9s %-12s %4s %-7s %s\n", "INDEX", "START_US", "DUR_US", "OP", "REG", "STATUS", "PAYLOAD");
+
+	while (reader.next(record)) {
+		printf("%8llu %12.1f %9.1f %-12s 0x%02x %-7s", (unsigned long long)index++, record.start / 1000.0, record.duration / 1000.0,
+			trace::opName(record.op), record.reg, record.status == trace::status_ok ? "ok" : (record.status == trace::status_refused ? "refused" : "failed"));
+		for (size_t i = 0; i < record.payload.size() && i < 16; i++) printf(" %02x", record.payload[i]);
+		if (record.payload.size() > 16) printf(" ... (%u byte)", (unsigned)record.payload.size());
+		printf("\n");
+	}
+}
+
+static void printUsage(usage_t &usage, uint64_t busTime) {
+	std::vector<std::pair<uint64_t, uint16_t> > sorted;
+	for (usage_t::iterator it = usage.begin(); it != usage.end(); ++it) sorted.push_back(std::make_pair(it->second.second, it->first));
+	std::sort(sorted.rbegin(), sorted.rend());
+
+	printf("%-12s %4s %10s %12s %7s\n", "OP", "REG", "COUNT", "TIME_MS", "SHARE");
+	for (size_t i = 0; i < sorted.size(); i++) {
+		uint16_t key = sorted[i].second;
+		printf("%-12s 0x%02x %10llu %12.3f %6.1f%%\n", trace::opName(key >> 8), key & 0xFF,
+			(unsigned long long)usage[key].first, sorted[i].first / 1e6, busTime ? 100.0 * sorted[i].first / busTime : 0.0);
+	}
+}
+
+static void stats(std::string filename) {
+	summary_s summary;
+	summarize(filename, summary, NULL);
+
+	printf("transactions: %llu (%llu failed)\n", (unsigned long long)summary.records, (unsigned long long)summary.failed);
+	printf("payload:      %llu byte\n", (unsigned long long)summary.bytes);
+	printf("wall time:    %.3f ms\n", summary.wallTime / 1e6);
+	printf("bus time:     %.3f ms\n", summary.busTime / 1e6);
+	printf("host gaps:    %.3f ms\n\n", (summary.wallTime - summary.busTime) / 1e6);
+
+	printUsage(summary.usage, summary.busTime);
+}
+
+static void diff(std::string first, std::string second) {
+	summary_s a, b;
+	std::vector<trace::record_s> ra, rb;
+	summarize(first, a, &ra);
+	summarize(second, b, &rb);
+
+	// The first transaction which differs in op, register or written data
+	size_t divergence = 0;
+	while (divergence < ra.size() && divergence < rb.size()) {
+		trace::record_s &x = ra[divergence];
+		trace::record_s &y = rb[divergence];
+		if (x.op != y.op || x.reg != y.reg || x.payload.size() != y.payload.size()) break;
+		if (trace::isWrite(x.op) && x.payload != y.payload) break;
+		divergence++;
+	}
+
+	printf("%-12s %14s %14s %10s\n", "", "A", "B", "DELTA");
+	printf("%-12s %14llu %14llu %+10lld\n", "transactions", (unsigned long long)a.records, (unsigned long long)b.records, (long long)b.records - (long long)a.records);
+	printf("%-12s %14.3f %14.3f %+10.3f\n", "bus ms", a.busTime / 1e6, b.busTime / 1e6, ((double)b.busTime - a.busTime) / 1e6);
+	printf("%-12s %14.3f %14.3f %+10.3f\n", "wall ms", a.wallTime / 1e6, b.wallTime / 1e6, ((double)b.wallTime - a.wallTime) / 1e6);
+
+	if (divergence == ra.size() && divergence == rb.size()) printf("\nThe traces are identical on the bus\n");
+	else printf("\nFirst difference at transaction %llu\n", (unsigned long long)divergence);
+
+	// Per register transaction counts
+	usage_t keys = a.usage;
+	keys.insert(b.usage.begin(), b.usage.end());
+
+	printf("\n%-12s %4s %10s %10s %10s\n", "OP", "REG", "A", "B", "DELTA");
+	for (usage_t::iterator it = keys.begin(); it != keys.end(); ++it) {
+		long long ca = a.usage.count(it->first) ? a.usage[it->first].first : 0;
+		long long cb = b.usage.count(it->first) ? b.usage[it->first].first : 0;
+		if (ca == cb) continue;
+		printf("%-12s 0x%02x %10lld %10lld %+10lld\n", trace::opName(it->first >> 8), it->first & 0xFF, ca, cb, cb - ca);
+	}
+}
+
+static uint32_t detectJedecId(std::string filename) {
+	trace::reader reader(filename);
+	trace::record_s record;
+	uint8_t opCode = 0;
+	uint32_t jedecId = 0;
+	int ports = 0;
+
+	// The JEDEC ID is the answer of the 0x9f common instruction
+	while (reader.next(record)) {
+		if (record.status != trace::status_ok || record.payload.empty()) continue;
+		if (record.op == trace::op_write && record.reg == devices::RTD2660::registers::common_op_code) opCode = record.payload[0];
+		if (record.op == trace::op_read && opCode == 0x9f
+			&& record.reg >= devices::RTD2660::registers::common_inst_read_port0
+			&& record.reg <= devices::RTD2660::registers::common_inst_read_port2) {
+			jedecId |= record.payload[0] << (8 * (devices::RTD2660::registers::common_inst_read_port2 - record.reg));
+			if (++ports == 3) return jedecId;
+		}
+	}
+
+	throw trace::exception("No JEDEC ID in the trace, use -j");
+}
+
+static int replay(std::string filename, std::string image, std::string output, uint32_t jedecId) {
+	if (jedecId == 0) jedecId = detectJedecId(filename);
+
+	simulator::rtd2660 device(jedecId);
+
+	if (image != "") {
+		FILE *fp = fopen(image.c_str(), "rb");
+		if (fp == NULL) throw trace::exception("Unable to open the image: " + image);
+		std::vector<uint8_t> content(device.getFlash().size(), 0xFF);
+		size_t readed = fread(&content[0], 1, content.size(), fp);
+		fclose(fp);
+		device.load(&content[0], readed);
+	}
+
+	trace::reader reader(filename);
+	trace::record_s record;
+	uint64_t index = 0, mismatches = 0, replayed = 0;
+
+	while (reader.next(record)) {
+		index++;
+		if (record.status != trace::status_ok) continue; // nothing happened on the bus
+		replayed++;
+
+		if (trace::isWrite(record.op)) {
+			for (size_t i = 0; i < record.payload.size(); i++) device.write(record.reg, record.payload[i]);
+			continue;
+		}
+
+		for (size_t i = 0; i < record.payload.size(); i++) {
+			uint8_t expected = record.payload[i];
+			uint8_t actual = device.read(record.reg);
+			if (expected == actual) continue;
+
+			if (mismatches < 10) {
+				printf("transaction %llu (%s 0x%02x) byte %u: trace %02x / simulator %02x\n", (unsigned long long)index - 1,
+					trace::opName(record.op), record.reg, (unsigned)i, expected, actual);
+			}
+			mismatches++;
+		}
+	}
+
+	printf("replayed %llu transaction(s) on a simulated device (jedec ID %06x), %llu mismatching byte(s)\n",
+		(unsigned long long)replayed, jedecId, (unsigned long long)mismatches);
+
+	if (output != "") {
+		FILE *fp = fopen(output.c_str(), "wb");
+		if (fp == NULL) throw trace::exception("Unable to open the output: " + output);
+		fwrite(&device.getFlash()[0], 1, device.getFlash().size(), fp);
+		fclose(fp);
+	}
+
+	return mismatches == 0 ? 0 : 2;
+}
+
+int main(int argc, char *argv[]) {
+
+	ArgumentParser parser("odc_trace");
+
+	parser.add_argument("-m", "Mode (dump / stats / diff / replay)", true);
+	parser.add_argument("-f", "Trace file (recorded by odc_prog -r)", true);
+	parser.add_argument("-b", "Second trace file for diff", false);
+	parser.add_argument("-i", "Initial flash image for replay (default: erased)", false);
+	parser.add_argument("-o", "Write the simulated flash into this file after replay", false);
+	parser.add_argument("-j", "Flash JEDEC ID for replay (default: detected from the trace)", false);
+
+	try {
+		parser.parse(argc, argv);
+	} catch (const ArgumentParser::ArgumentNotFound& ex) {
+		std::cout << ex.what() << std::endl;
+		return 0;
+	}
+
+	if (parser.is_help()) {
+		std::cout << std::endl << "dump: print every transaction" << std::endl
+				<< "stats: where the bus time went, per op and register" << std::endl
+				<< "diff: compare the transactions of two traces (-b)" << std::endl
+				<< "replay: feed the trace into a simulated device and check every readed byte" << std::endl << std::endl;
+		return 0;
+	}
+
+	static plog::ColorConsoleAppender<plog::TxtFormatter> consoleAppender(plog::streamStdErr);
+	plog::init(plog::warning, &consoleAppender);
+
+	std::string mode = parser.get<std::string>("m");
+	std::string file = parser.get<std::string>("f");
+	std::string jedec = parser.get<std::string>("j");
+
+	try {
+		if (mode == "dump") dump(file);
+		else if (mode == "stats") stats(file);
+		else if (mode == "diff") diff(file, parser.get<std::string>("b"));
+		else if (mode == "replay") return replay(file, parser.get<std::string>("i"), parser.get<std::string>("o"), strtoul(jedec.c_str(), NULL, 16));
+		else {
+			std::cerr << "Unknown mode: " << mode << std::endl;
+			return 1;
+		}
+	} catch(trace::exception& e) {
+		std::cerr << "trace exception: " << e.what() << std::endl;
+		return 1;
+	} catch(std::exception& e) {
+		std::cerr << "std::exception: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+#include <plog/Log.h>
+#include <CRC.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#include "patch.h"
+
+using namespace patch;
+
+// Programs the changed bytes of one sector page by page, without an erase: a page program
+// can only clear bits, so the unchanged bytes around them don't need to be sent
+static uint32_t programChanges(devices::device *device, uint32_t sectorAddress, uint32_t pageSize, std::vector<uint8_t> &original, std::vector<uint8_t> &sector) {
+	uint32_t programmed = 0;
+
+	for (uint32_t page = 0; page < sector.size(); page += pageSize) {
+		uint32_t pageEnd = std::min((uint32_t)sector.size(), page + pageSize);
+
+		uint32_t first = page;
+		while (first < pageEnd && sector[first] == original[first]) first++;
+		if (first == pageEnd) continue;
+
+		uint32_t last = pageEnd - 1;
+		while (sector[last] == original[last]) last--;
+
+		device->programFlashContent(&sector[first], sectorAddress + first, last - first + 1, false);
+		programmed += last - first + 1;
+	}
+
+	return programmed;
+}
+
+static void patchSector(devices::device *device, flash::device *flash, uint32_t sectorAddress, uint32_t address, const uint8_t *data, uint32_t size, bool &writing, stats_s &stats) {
+	uint32_t sectorSize = flash->getSectorSize();
+
+	std::vector<uint8_t> original(sectorSize);
+	device->readFlashContent(&original[0], sectorAddress, sectorSize);
+
+	// The part of the patch inside this sector
+	uint32_t start = std::max(address, sectorAddress);
+	uint32_t end = std::min((uint64_t)address + size, (uint64_t)sectorAddress + sectorSize);
+
+	std::vector<uint8_t> sector = original;
+	memcpy(&sector[start - sectorAddress], data + (start - address), end - start);
+
+	stats.sectors++;
+
+	if (sector == original) {
+		PLOG_INFO << "[patch] Sector at 0x" << std::hex << sectorAddress << " already holds the bytes";
+		return;
+	}
+
+	bool needsErase = false;
+	for (uint32_t i = start - sectorAddress; i < end - sectorAddress && !needsErase; i++) {
+		if ((original[i] & sector[i]) != sector[i]) needsErase = true;
+	}
+
+	if (!writing) {
+		device->beginFlashWrite(false);
+		writing = true;
+	}
+
+	if (needsErase) {
+		if (flash->getOpCode_sectorErase() == -1 && flash->getOpCode_blockErase() == -1) {
+			throw patch::exception("The patch sets bits, but the flash chip hasnt got sector or block erase support");
+		}
+
+		PLOG_INFO << "[patch] Rewrite the sector at 0x" << std::hex << sectorAddress;
+		device->eraseFlashSector(sectorAddress);
+		device->programFlashContent(&sector[0], sectorAddress, sectorSize, true);
+		stats.erased++;
+		stats.programmed += sectorSize;
+	} else {
+		PLOG_INFO << "[patch] Program the changed bytes of the sector at 0x" << std::hex << sectorAddress << " without an erase";
+		stats.programmed += programChanges(device, sectorAddress, flash->getPageSize(), original, sector);
+	}
+
+	uint8_t expected = CRC::Calculate(&sector[0], sectorSize, CRC::CRC_8());
+	if (device->calculateCRC(sectorAddress, sectorAddress + sectorSize - 1) != expected) {
+		std::stringstream msg;
+		msg << "CRC mismatch after the patch of the sector at 0x" << std::hex << sectorAddress;
+		throw patch::exception(msg.str());
+	}
+}
+
+stats_s patch::write(isp::session *session, uint32_t address, const uint8_t *data, uint32_t size) {
+	if (!session->isOpened()) throw patch::exception("The device isnt in ISP mode");
+
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	if (data == NULL || size == 0) throw patch::exception("Empty patch");
+	if ((uint64_t)address + size > flash->getSize()) throw patch::exception("The patch is out of the flash");
+
+	uint32_t sectorSize = flash->getSectorSize();
+	uint32_t first = address - address % sectorSize;
+
+	PLOG_INFO << "[patch] " << std::dec << size << " byte to address 0x" << std::hex << std::setfill('0') << std::setw(6) << address
+		<< " (" << std::dec << sectorSize << " byte sectors)";
+
+	stats_s stats;
+	memset(&stats, 0, sizeof(stats));
+	bool writing = false;
+
+	try {
+		for (uint64_t sector = first; sector < (uint64_t)address + size; sector += sectorSize) {
+			patchSector(device, flash, sector, address, data, size, writing, stats);
+		}
+	} catch (...) {
+		// The protection is restored even if the patch failed halfway
+		if (writing) {
+			try {
+				device->endFlashWrite();
+			} catch (...) {}
+		}
+		throw;
+	}
+
+	if (writing) device->endFlashWrite();
+
+	PLOG_INFO << "[patch] Done: " << std::dec << stats.sectors << " sector(s), " << stats.erased << " erased, " << stats.programmed << " byte programmed";
+
+	return stats;
+}
+
+std::vector<uint8_t> patch::parseBytes(std::string hex) {
+	std::string digits;
+	for (size_t i = 0; i < hex.size(); i++) {
+		if (isspace((unsigned char)hex[i])) continue;
+		if (!isxdigit((unsigned char)hex[i])) throw patch::exception("Invalid hex byte: " + hex);
+		digits += hex[i];
+	}
+
+	if (digits.empty() || digits.size() % 2 != 0) throw patch::exception("Invalid hex bytes: " + hex);
+
+	std::vector<uint8_t> result;
+	for (size_t i = 0; i < digits.size(); i += 2) result.push_back(strtoul(digits.substr(i, 2).c_str(), NULL, 16));
+
+	return result;
+}
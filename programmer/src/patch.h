@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+
+namespace patch {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Byte granular write into the flash of an opened session, for a serial number or a
+		calibration value without a full upload.
+
+		Only the erase sectors of the range are read back. If the new bytes only clear bits
+		(1 -> 0) the changed bytes are programmed over the old content, otherwise the sector
+		is erased and reprogrammed. Every touched sector is checked by the hardware CRC.
+	*/
+
+	struct stats_s {
+		uint32_t sectors;     // touched sectors
+		uint32_t erased;      // sectors which needed an erase
+		uint32_t programmed;  // programmed byte
+	};
+
+	stats_s write(isp::session *session, uint32_t address, const uint8_t *data, uint32_t size);
+
+	// "0a1b2c" or "0a 1b 2c" -> bytes
+	std::vector<uint8_t> parseBytes(std::string hex);
+
+};
@@ -0,0 +1,480 @@
+#include <plog/Log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "planner.h"
+#include "stream.h"
+
+using namespace planner;
+
+// Weight of the last run in the calibration factors
+const double CALIBRATION_WEIGHT = 0.3;
+
+// One program cycle of the controller
+const uint32_t PROGRAM_PAGE = 256;
+
+static const char *actionNames[] = {"erase_chip", "erase_block", "program", "verify_crc", "verify_read", "read"};
+static const char *modeNames[] = {"smbus", "raw"};
+
+const char *planner::actionName(int action) {
+	if (action < 0 || action >= ACTION_COUNT) return "unknown";
+	return actionNames[action];
+}
+
+static int transferMode(size_t transferSize) {
+	return transferSize > i2c::SMBUS_BLOCK_MAX ? 1 : 0;
+}
+
+/*
+	Model
+*/
+
+std::string planner::modelPath() {
+	const char *cache = getenv("XDG_CACHE_HOME");
+	if (cache != NULL && cache[0] != 0) return std::string(cache) + "/odc_prog/costs";
+
+	const char *home = getenv("HOME");
+	if (home != NULL && home[0] != 0) return std::string(home) + "/.cache/odc_prog/costs";
+
+	return "odc_costs";
+}
+
+void planner::loadModel(model_s &model) {
+	// Defaults for a 100 kHz bus, the calibration takes over after the first runs
+	model.transaction = 250;
+	model.smbusByte = 95;
+	model.rawByte = 90;
+	model.pageProgram = 1500;
+	model.blockErase = 500000;
+	model.chipErase = 8000;
+	model.crc = 100;
+	model.transferSize = i2c::SMBUS_BLOCK_MAX;
+	model.writeSize = i2c::SMBUS_BLOCK_MAX;
+
+	for (int a = 0; a < ACTION_COUNT; a++) model.scale[a][0] = model.scale[a][1] = 1.0;
+
+	std::ifstream file(planner::modelPath().c_str());
+	if (!file) return;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream entry(line);
+		std::string key;
+		double value;
+
+		entry >> key >> value;
+		if (!entry) continue;
+
+		if (key == "transaction") model.transaction = value;
+		else if (key == "smbus_byte") model.smbusByte = value;
+		else if (key == "raw_byte") model.rawByte = value;
+		else if (key == "page_program") model.pageProgram = value;
+		else if (key == "block_erase") model.blockErase = value;
+		else if (key == "chip_erase") model.chipErase = value;
+		else if (key == "crc") model.crc = value;
+		else if (key == "transfer_size") model.transferSize = value;
+		else if (key == "write_size") model.writeSize = value;
+		else {
+			for (int a = 0; a < ACTION_COUNT; a++) {
+				for (int m = 0; m < 2; m++) {
+					if (key == std::string("scale.") + actionNames[a] + "." + modeNames[m]) model.scale[a][m] = value;
+				}
+			}
+		}
+	}
+}
+
+void planner::saveModel(model_s &model) {
+	std::string path = planner::modelPath();
+
+	// create the parent directories
+	for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+		mkdir(path.substr(0, pos).c_str(), 0755);
+	}
+
+	std::ofstream file(path.c_str(), std::ios::trunc);
+	if (!file) {
+		PLOG_WARNING << "[planner] Unable to write the cost model: " << path;
+		return;
+	}
+
+	file << "transaction " << model.transaction << std::endl
+		<< "smbus_byte " << model.smbusByte << std::endl
+		<< "raw_byte " << model.rawByte << std::endl
+		<< "page_program " << model.pageProgram << std::endl
+		<< "block_erase " << model.blockErase << std::endl
+		<< "chip_erase " << model.chipErase << std::endl
+		<< "crc " << model.crc << std::endl
+		<< "transfer_size " << model.transferSize << std::endl
+		<< "write_size " << model.writeSize << std::endl;
+
+	for (int a = 0; a < ACTION_COUNT; a++) {
+		for (int m = 0; m < 2; m++) file << "scale." << actionNames[a] << "." << modeNames[m] << " " << model.scale[a][m] << std::endl;
+	}
+}
+
+/*
+	Cost formulas, they follow the transactions of devices::rtd2660
+*/
+
+// SPI_commonCommand: instruction, op code, address bytes, enable, at least one poll, read ports
+static double commandCost(model_s &model) {
+	return 9 * model.transaction;
+}
+
+static double transferCost(model_s &model, uint32_t size, size_t transferSize) {
+	uint32_t count = (size + transferSize - 1) / transferSize;
+	return count * model.transaction + size * (transferMode(transferSize) ? model.rawByte : model.smbusByte);
+}
+
+// calculateCRC: start and end address, start, at least one poll, result
+static double crcCost(model_s &model, uint32_t size) {
+	return 9 * model.transaction + size / 1024.0 * model.crc;
+}
+
+// SPI_read: one read command per 1 kb chunk
+static double readCost(model_s &model, uint32_t size, size_t transferSize) {
+	return ((size + 1023) / 1024) * commandCost(model) + transferCost(model, size, transferSize);
+}
+
+// programFlashContent: length, address, program_instruction read and write, at least one poll, the data
+// (the page data goes in the validated write size, the probed transfer size holds for the reads only)
+static double programCost(model_s &model, uint32_t pages, size_t transferSize) {
+	return pages * (7 * model.transaction + transferCost(model, PROGRAM_PAGE, std::min(transferSize, (size_t)model.writeSize)) + model.pageProgram);
+}
+
+static void addStep(model_s &model, plan_s &plan, action_e action, uint32_t address, uint32_t size, double cost) {
+	step_s step;
+	step.action = action;
+	step.address = address;
+	step.size = size;
+	step.estimate = cost * model.scale[action][transferMode(plan.transferSize)];
+
+	plan.steps.push_back(step);
+	plan.estimate += step.estimate;
+}
+
+static bool cheaper(const plan_s &a, const plan_s &b) {
+	return a.estimate < b.estimate;
+}
+
+static std::vector<size_t> transferSizes(size_t transferSize) {
+	std::vector<size_t> sizes(1, i2c::SMBUS_BLOCK_MAX);
+	if (transferSize > i2c::SMBUS_BLOCK_MAX) sizes.push_back(transferSize);
+	return sizes;
+}
+
+std::vector<plan_s> planner::planDownload(model_s &model, flash::device *flash, size_t transferSize) {
+	std::vector<plan_s> plans;
+	std::vector<size_t> sizes = transferSizes(transferSize);
+
+	uint32_t windowSize = flash->getBlockSize();
+
+	// Every window is read: a matching CRC-8 can't prove a range blank (one random range out of 256 matches),
+	// so a download never skips a read on the CRC alone
+	for (size_t t = 0; t < sizes.size(); t++) {
+		plan_s plan;
+		plan.operation = "download";
+		plan.eraseChip = plan.eraseBlocks = plan.readbackVerify = false;
+		plan.transferSize = sizes[t];
+		plan.estimate = 0;
+
+		for (uint32_t address = 0; address < flash->getSize(); address += windowSize) {
+			addStep(model, plan, read_full, address, windowSize, readCost(model, windowSize, plan.transferSize) + crcCost(model, windowSize));
+		}
+
+		plans.push_back(plan);
+	}
+
+	std::stable_sort(plans.begin(), plans.end(), cheaper);
+	return plans;
+}
+
+std::vector<plan_s> planner::planUpload(model_s &model, flash::device *flash, size_t transferSize, layout::image &image) {
+	std::vector<plan_s> plans;
+	std::vector<size_t> sizes = transferSizes(transferSize);
+
+	uint32_t windowSize = flash->getBlockSize();
+
+	if (image.size() > flash->getSize()) throw planner::exception("The image is larger than the flash chip");
+
+	// Pages with data in every window: only these are programmed after an erase
+	// (the gaps of a layout are blank without a look at any data)
+	std::vector<uint32_t> dataPages;
+	for (uint32_t address = 0; address < image.size(); address += windowSize) {
+		uint32_t end = std::min(image.size(), address + windowSize);
+		uint32_t pages = 0;
+		for (uint32_t page = address; page < end; page += PROGRAM_PAGE) {
+			if (!image.isBlank(page, std::min(end - page, PROGRAM_PAGE))) pages++;
+		}
+		dataPages.push_back(pages);
+	}
+
+	// 0: chip erase / 1: block erase / 2: no erase (only if the flash has no erase support)
+	std::vector<int> erases;
+	if (flash->getOpCode_chipErase() != -1) erases.push_back(0);
+	if (flash->getOpCode_blockErase() != -1) erases.push_back(1);
+	if (erases.empty()) erases.push_back(2);
+
+	for (size_t t = 0; t < sizes.size(); t++) {
+		for (size_t e = 0; e < erases.size(); e++) {
+			for (int readback = 0; readback < 2; readback++) {
+				plan_s plan;
+				plan.operation = "upload";
+				plan.eraseChip = (erases[e] == 0);
+				plan.eraseBlocks = (erases[e] == 1);
+				plan.readbackVerify = readback;
+				plan.transferSize = sizes[t];
+				plan.estimate = 0;
+
+				bool erased = plan.eraseChip || plan.eraseBlocks;
+
+				if (plan.eraseChip) addStep(model, plan, erase_chip, 0, flash->getSize(), commandCost(model) + flash->getSize() / 1024.0 * model.chipErase);
+
+				for (uint32_t address = 0, window = 0; address < image.size(); address += windowSize, window++) {
+					uint32_t size = std::min(image.size() - address, windowSize);
+					uint32_t pages = erased ? dataPages[window] : (size + PROGRAM_PAGE - 1) / PROGRAM_PAGE;
+
+					if (plan.eraseBlocks) addStep(model, plan, erase_block, address, windowSize, 2 * commandCost(model) + model.blockErase);
+					if (pages > 0) addStep(model, plan, program, address, size, programCost(model, pages, plan.transferSize));
+
+					if (readback) addStep(model, plan, verify_read, address, size, readCost(model, size, plan.transferSize));
+					else addStep(model, plan, verify_crc, address, size, crcCost(model, size));
+				}
+
+				plans.push_back(plan);
+			}
+		}
+	}
+
+	std::stable_sort(plans.begin(), plans.end(), cheaper);
+	return plans;
+}
+
+std::string planner::describe(plan_s &plan) {
+	std::stringstream text;
+
+	text << plan.operation << ": ";
+	if (plan.operation == "download") text << "full read";
+	else {
+		if (plan.eraseChip) text << "chip erase";
+		else if (plan.eraseBlocks) text << "block erase";
+		else text << "no erase";
+		text << ", " << (plan.readbackVerify ? "readback verify" : "CRC verify");
+	}
+	text << ", " << plan.transferSize << " byte " << (transferMode(plan.transferSize) ? "i2c" : "SMBus") << " transfers";
+
+	return text.str();
+}
+
+void planner::print(std::vector<plan_s> &plans) {
+	if (plans.empty()) return;
+
+	plan_s &plan = plans[0];
+
+	printf("Plan: %s\n\n", planner::describe(plan).c_str());
+	printf("%-12s %8s %12s %10s\n", "ACTION", "COUNT", "BYTE", "EST_S");
+
+	for (int a = 0; a < ACTION_COUNT; a++) {
+		uint64_t count = 0, bytes = 0;
+		double estimate = 0;
+		for (size_t i = 0; i < plan.steps.size(); i++) {
+			if (plan.steps[i].action != a) continue;
+			count++;
+			bytes += plan.steps[i].size;
+			estimate += plan.steps[i].estimate;
+		}
+		if (count == 0) continue;
+		printf("%-12s %8llu %12llu %10.1f\n", actionNames[a], (unsigned long long)count, (unsigned long long)bytes, estimate / 1e6);
+	}
+
+	printf("\nEstimated duration: %.1f s\n", plan.estimate / 1e6);
+
+	if (plans.size() > 1) {
+		printf("\nAlternatives:\n");
+		for (size_t i = 1; i < plans.size(); i++) printf("  %8.1f s  %s\n", plans[i].estimate / 1e6, planner::describe(plans[i]).c_str());
+	}
+}
+
+void planner::loadImage(std::string filename, flash::device *flash, layout::image &image) {
+	image.add(0, filename);
+
+	if (image.size() > flash->getSize()) {
+		PLOG_WARNING << "The binary is larger than the flash chip, the rest is ignored";
+		image.truncate(flash->getSize());
+	}
+}
+
+/*
+	Execution
+*/
+
+static double elapsed(struct timespec &start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+static void calibrate(model_s &model, plan_s &plan, double *measured, double *estimated) {
+	int mode = transferMode(plan.transferSize);
+	double totalMeasured = 0, totalEstimated = 0;
+
+	for (int a = 0; a < ACTION_COUNT; a++) {
+		if (estimated[a] <= 0 || measured[a] <= 0) continue;
+
+		totalMeasured += measured[a];
+		totalEstimated += estimated[a];
+
+		// One odd run (a busy bus, an interrupted transfer) must not ruin the model
+		double ratio = std::max(0.1, std::min(10.0, measured[a] / estimated[a]));
+		model.scale[a][mode] *= (1 - CALIBRATION_WEIGHT) + CALIBRATION_WEIGHT * ratio;
+
+		PLOG_DEBUG << "[planner] " << actionNames[a] << ": estimated " << estimated[a] / 1e6 << " s, measured " << measured[a] / 1e6
+			<< " s, new factor " << model.scale[a][mode];
+	}
+
+	PLOG_INFO << "Estimated " << std::fixed << std::setprecision(1) << totalEstimated / 1e6 << " s, took " << totalMeasured / 1e6 << " s";
+
+	planner::saveModel(model);
+}
+
+void planner::executeDownload(isp::session *session, plan_s &plan, std::string filename, model_s &model) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	PLOG_INFO << "Plan: " << planner::describe(plan);
+
+	session->getConnection()->setMaxTransferSize(plan.transferSize);
+
+	double measured[ACTION_COUNT] = {0}, estimated[ACTION_COUNT] = {0};
+
+	uint32_t windowSize = flash->getBlockSize();
+
+	uint8_t *buffer = (uint8_t*)malloc(windowSize);
+	if (buffer == NULL) throw planner::exception("Unable to allocate memory for firmware");
+
+	try {
+		stream::file output(filename, true);
+		output.setPipeSize(windowSize);
+
+		for (size_t i = 0; i < plan.steps.size(); i++) {
+			step_s &step = plan.steps[i];
+
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+			device->readFlashContent(buffer, step.address, step.size);
+
+			measured[step.action] += elapsed(start);
+			estimated[step.action] += step.estimate;
+
+			output.write(buffer, step.size);
+		}
+	} catch (...) {
+		free(buffer);
+		throw;
+	}
+
+	free(buffer);
+
+	calibrate(model, plan, measured, estimated);
+}
+
+// Every run of non-blank pages is programmed in one call, the device overlaps the pages of a call.
+// The runs go straight from the segments, only a run across a segment edge or a gap is assembled
+static void programWindow(devices::device *device, layout::image &image, uint32_t address, uint32_t size, bool erased, uint8_t *window) {
+	uint32_t offset = 0;
+
+	while (offset < size) {
+		uint32_t length = std::min(PROGRAM_PAGE, size - offset);
+		if (erased && image.isBlank(address + offset, length)) {
+			offset += length;
+			continue;
+		}
+
+		uint32_t runSize = length;
+		while (offset + runSize < size) {
+			length = std::min(PROGRAM_PAGE, size - offset - runSize);
+			if (erased && image.isBlank(address + offset + runSize, length)) break;
+			runSize += length;
+		}
+
+		const uint8_t *data = image.direct(address + offset, runSize);
+		if (data == NULL) {
+			image.copy(address + offset, window, runSize);
+			data = window;
+		}
+
+		device->programFlashContent((uint8_t*)data, address + offset, runSize, erased);
+		offset += runSize;
+	}
+}
+
+void planner::executeUpload(isp::session *session, plan_s &plan, layout::image &image, model_s &model) {
+	devices::device *device = session->getDevice();
+	flash::device *flash = session->getFlash();
+
+	PLOG_INFO << "Plan: " << planner::describe(plan);
+
+	session->getConnection()->setMaxTransferSize(plan.transferSize);
+
+	double measured[ACTION_COUNT] = {0}, estimated[ACTION_COUNT] = {0};
+	bool erased = plan.eraseChip || plan.eraseBlocks;
+
+	std::vector<uint8_t> readback(flash->getBlockSize());
+	std::vector<uint8_t> window(flash->getBlockSize());
+
+	// The chip erase is the first step of its plan, the other plans only unprotect here
+	if (!plan.eraseChip) device->beginFlashWrite(false);
+
+	for (size_t i = 0; i < plan.steps.size(); i++) {
+		step_s &step = plan.steps[i];
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		switch (step.action) {
+			case erase_chip:
+				if (!device->beginFlashWrite(true)) throw planner::exception("The chip erase failed");
+				break;
+			case erase_block:
+				device->eraseFlashBlock(step.address);
+				break;
+			case program:
+				programWindow(device, image, step.address, step.size, erased, &window[0]);
+				break;
+			case verify_crc:
+				if (device->calculateCRC(step.address, step.address + step.size - 1) != image.crc(step.address, step.size)) {
+					std::stringstream msg;
+					msg << "CRC mismatch in the window at 0x" << std::hex << step.address;
+					throw planner::exception(msg.str());
+				}
+				break;
+			case verify_read:
+				device->readFlashData(&readback[0], step.address, step.size);
+				if (!image.equals(step.address, &readback[0], step.size)) {
+					std::stringstream msg;
+					msg << "Readback mismatch in the window at 0x" << std::hex << step.address;
+					throw planner::exception(msg.str());
+				}
+				break;
+			default:
+				throw planner::exception(std::string("Unexpected step in an upload plan: ") + actionNames[step.action]);
+		}
+
+		measured[step.action] += elapsed(start);
+		estimated[step.action] += step.estimate;
+	}
+
+	device->endFlashWrite();
+
+	PLOG_INFO << "Write finished (" << std::dec << image.size() << " byte)";
+
+	calibrate(model, plan, measured, estimated);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include "session.h"
+#include "flash.h"
+#include "layout.h"
+
+namespace planner {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	// Everything a plan is made of, each action has its own cost formula and calibration factor
+	enum action_e {
+		erase_chip,
+		erase_block,
+		program,      // page programs of one window
+		verify_crc,   // hardware CRC of one window against the local CRC
+		verify_read,  // read back one window and compare it
+		read_full,    // read one window, CRC checked
+		ACTION_COUNT
+	};
+
+	const char *actionName(int action);
+
+	/*
+		Cost model, all of the times are in microseconds. The formulas are built from these
+		coefficients, then every action is multiplied with its calibration factor (per transfer
+		mode: SMBus / raw), which follows the measured / estimated ratio of the previous runs.
+	*/
+	struct model_s {
+		double transaction;   // one register read or write on the bus
+		double smbusByte;     // payload byte in 32 byte SMBus blocks
+		double rawByte;       // payload byte in raw i2c transfers
+		double pageProgram;   // page program cycle of the flash
+		double blockErase;    // one block erase
+		double chipErase;     // chip erase, per kb of the flash
+		double crc;           // hardware CRC, per kb
+
+		uint32_t transferSize; // last probed transfer size, used by the dry run without device
+		uint32_t writeSize;    // last validated page write size (SMBus block size without a bench run)
+
+		double scale[ACTION_COUNT][2];
+	};
+
+	struct step_s {
+		action_e action;
+		uint32_t address;
+		uint32_t size;
+		double estimate;
+	};
+
+	struct plan_s {
+		std::string operation;  // download / upload
+		bool eraseChip;
+		bool eraseBlocks;
+		bool readbackVerify;
+		size_t transferSize;
+		std::vector<step_s> steps;
+		double estimate;
+	};
+
+	std::string modelPath();
+	void loadModel(model_s &model);
+	void saveModel(model_s &model);
+
+	// Every applicable strategy with its estimate, the cheapest one is the first
+	std::vector<plan_s> planDownload(model_s &model, flash::device *flash, size_t transferSize);
+	std::vector<plan_s> planUpload(model_s &model, flash::device *flash, size_t transferSize, layout::image &image);
+
+	void print(std::vector<plan_s> &plans);
+	std::string describe(plan_s &plan);
+
+	// A plain binary from the start of the flash (the part which doesn't fit is dropped)
+	void loadImage(std::string filename, flash::device *flash, layout::image &image);
+
+	// Run the plan, then calibrate the model with the measured times
+	void executeDownload(isp::session *session, plan_s &plan, std::string filename, model_s &model);
+	void executeUpload(isp::session *session, plan_s &plan, layout::image &image, model_s &model);
+
+};
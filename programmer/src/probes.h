@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+	USDT probes of the "odc" provider for bpftrace / perf / systemtap (see tools/bpftrace).
+	A probe is one nop in the code until a tracer attaches, without sys/sdt.h (HAVE_SYS_SDT_H)
+	they are compiled out. The arguments are cheap values only, the latencies are measured
+	by the tracer between the start and the done probes.
+
+		sudo bpftrace -p $(pidof odc_prog) tools/bpftrace/i2c_latency.bt
+		sudo perf buildid-cache --add bin/libodc.so && sudo perf record -e sdt_odc:page__start -p $(pidof odc_prog)
+
+	i2c__start(op, reg)                      before one i2c transaction (op: trace::ops)
+	i2c__done(op, reg, length, status)       after it (status: trace::status, length: payload / batch writes)
+	command__start(opcode, readNum)          common instruction (SPI command) of the controller
+	command__done(opcode, result)
+	wait(kind, value)                        every poll of a wait loop (kind: probes::waits, value: the polled register)
+	page__start(address, length, overlapped) page program cycle started (prog_en)
+	page__done(address, length)              the cycle finished
+	erase__start(address, size)              block / sector / chip erase
+	erase__done(address, size)
+	crc__start(start, end)                   hardware CRC of a range
+	crc__done(start, end, crc)
+*/
+
+#ifdef HAVE_SYS_SDT_H
+	#include <sys/sdt.h>
+	#define ODC_PROBE2(name, a, b) DTRACE_PROBE2(odc, name, a, b)
+	#define ODC_PROBE3(name, a, b, c) DTRACE_PROBE3(odc, name, a, b, c)
+	#define ODC_PROBE4(name, a, b, c, d) DTRACE_PROBE4(odc, name, a, b, c, d)
+#else
+	// sizeof keeps the arguments "used" without evaluating them
+	#define ODC_PROBE2(name, a, b) do {(void)sizeof(a); (void)sizeof(b);} while (0)
+	#define ODC_PROBE3(name, a, b, c) do {(void)sizeof(a); (void)sizeof(b); (void)sizeof(c);} while (0)
+	#define ODC_PROBE4(name, a, b, c, d) do {(void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d);} while (0)
+#endif
+
+namespace probes {
+
+	enum waits {
+		wait_operation = 0,	// comm_inst_en of a common instruction
+		wait_program   = 1,	// prog_en of a page program
+		wait_buffer    = 2,	// prog_buf_wr_en of the overlapped upload
+		wait_busy      = 3,	// WIP bit of the flash status register
+		wait_crc       = 4	// crc_done of the hardware CRC
+	};
+
+};
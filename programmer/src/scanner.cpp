@@ -0,0 +1,201 @@
+#include <plog/Log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "scanner.h"
+#include "i2c.h"
+#include "flash.h"
+#include "trace.h"
+#include "devices/rtd2660.h"
+
+using namespace scanner;
+
+std::vector<int> scanner::listAdapters() {
+	std::vector<int> adapters;
+
+	DIR *dir = opendir("/dev");
+	if (dir == NULL) return adapters;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		int adapter;
+		char tail;
+		if (sscanf(entry->d_name, "i2c-%d%c", &adapter, &tail) == 1) adapters.push_back(adapter);
+	}
+
+	closedir(dir);
+
+	std::sort(adapters.begin(), adapters.end());
+	return adapters;
+}
+
+static void probe(result_s &result, uint64_t deadline) {
+	i2c::connection *conn;
+	try {
+		conn = new i2c::connection(result.adapter, result.address);
+	} catch (i2c::exception& e) {
+		result.status = std::string(e.what());
+		return;
+	}
+
+	// Every transaction of the probe has to start before the deadline, a hanging bus ends the probe
+	conn->setDeadline(deadline);
+
+	devices::rtd2660 device(conn);
+	bool entered = false;
+
+	try {
+		// Only a controller which sets the isp_en bit and answers a JEDEC ID is accepted,
+		// and the ISP mode is left as it was found (a device already in ISP is not restarted)
+		if (!device.isInISPMode()) {
+			device.enterISPMode();
+			entered = true;
+		}
+
+		result.jedecId = device.getFlashJedecID();
+
+		if (result.jedecId == 0x000000 || result.jedecId == 0xFFFFFF) {
+			result.status = "no flash answer";
+		} else {
+			// The flash answered through the ISP interface, the controller is identified
+			result.controller = "rtd2660";
+			try {
+				flash::device flash(result.jedecId);
+				result.flashName = flash.getName();
+				result.flashSize = flash.getSize();
+				result.status = "ok";
+			} catch (std::exception& e) {
+				result.flashName = "unknown";
+				result.status = "unknown flash";
+			}
+		}
+	} catch (i2c::exception& e) {
+		result.status = conn->isExpired() ? "timeout" : "no response";
+	} catch (devices::exception& e) {
+		result.status = conn->isExpired() ? "timeout" : std::string(e.what());
+	}
+
+	// The ISP mode is left even after the deadline, a scan must not leave a stopped controller behind
+	conn->setDeadline(0);
+	try {
+		if (entered) device.exitISPMode();
+	} catch (...) {
+		PLOG_WARNING << "[scanner] Unable to exit ISP mode on i2c-" << result.adapter;
+	}
+
+	delete conn;
+}
+
+std::vector<result_s> scanner::scan(std::vector<uint8_t> addresses, unsigned int timeoutMs) {
+	std::vector<int> adapters = scanner::listAdapters();
+	std::vector<result_s> results(adapters.size() * addresses.size());
+	std::vector<std::thread> threads;
+
+	PLOG_INFO << "[scanner] Probing " << adapters.size() << " i2c adapter(s)";
+
+	uint64_t deadline = trace::now() + (uint64_t)timeoutMs * 1000000;
+
+	// One thread per adapter and address, adapters are independent buses
+	for (size_t i = 0; i < adapters.size(); i++) {
+		for (size_t j = 0; j < addresses.size(); j++) {
+			result_s &result = results[i * addresses.size() + j];
+			result.adapter = adapters[i];
+			result.address = addresses[j];
+			result.jedecId = 0;
+			result.flashSize = 0;
+			result.status = "timeout";
+
+			threads.push_back(std::thread(probe, std::ref(result), deadline));
+		}
+	}
+
+	// Every probe is waited for: the deadline ends the hanging ones, and a probe has to leave
+	// the ISP mode (and stop logging) before the scan returns
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+	for (size_t i = 0; i < results.size(); i++) {
+		result_s &result = results[i];
+
+		std::stringstream name;
+		name << (result.controller.empty() ? "i2c" : result.controller) << "-" << result.adapter;
+		if (result.address != DEFAULT_ADDRESS) name << "-" << std::hex << (int)result.address;
+		result.name = name.str();
+	}
+
+	return results;
+}
+
+void scanner::printTable(std::vector<result_s> &results) {
+	printf("%-16s %-4s %-7s %-11s %-8s %-14s %-10s %s\n", "NAME", "BUS", "ADDRESS", "CONTROLLER", "JEDEC", "FLASH", "SIZE", "STATUS");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		result_s &r = results[i];
+		if (r.status == "ok" || r.status == "unknown flash") {
+			printf("%-16s %-4d 0x%02x    %-11s %06x   %-14s %-10u %s\n", r.name.c_str(), r.adapter, r.address,
+				r.controller.c_str(), r.jedecId, r.flashName.c_str(), r.flashSize, r.status.c_str());
+		} else {
+			printf("%-16s %-4d 0x%02x    %-11s %-8s %-14s %-10s %s\n", "-", r.adapter, r.address, "-", "-", "-", "-", r.status.c_str());
+		}
+	}
+}
+
+std::string scanner::cachePath() {
+	const char *cache = getenv("XDG_CACHE_HOME");
+	if (cache != NULL && cache[0] != 0) return std::string(cache) + "/odc_prog/devices";
+
+	const char *home = getenv("HOME");
+	if (home != NULL && home[0] != 0) return std::string(home) + "/.cache/odc_prog/devices";
+
+	return "odc_devices";
+}
+
+void scanner::saveCache(std::vector<result_s> &results) {
+	std::string path = scanner::cachePath();
+
+	// create the parent directories
+	for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+		mkdir(path.substr(0, pos).c_str(), 0755);
+	}
+
+	std::ofstream cache(path.c_str(), std::ios::trunc);
+	if (!cache) {
+		PLOG_WARNING << "[scanner] Unable to write the device cache: " << path;
+		return;
+	}
+
+	// name adapter address controller jedec flash size
+	for (size_t i = 0; i < results.size(); i++) {
+		result_s &r = results[i];
+		if (r.status != "ok") continue;
+		cache << r.name << " " << std::dec << r.adapter << " " << (int)r.address << " " << r.controller << " "
+			<< r.jedecId << " " << r.flashName << " " << r.flashSize << std::endl;
+	}
+
+	PLOG_DEBUG << "[scanner] Device cache saved: " << path;
+}
+
+bool scanner::lookup(std::string name, result_s &result) {
+	std::ifstream cache(scanner::cachePath().c_str());
+	if (!cache) return false;
+
+	std::string line;
+	while (std::getline(cache, line)) {
+		std::istringstream entry(line);
+		int address;
+
+		entry >> result.name >> result.adapter >> address >> result.controller >> result.jedecId >> result.flashName >> result.flashSize;
+		if (!entry || result.name != name) continue;
+
+		result.address = address;
+		result.status = "ok";
+		return true;
+	}
+
+	return false;
+}
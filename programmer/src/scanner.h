@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace scanner {
+
+	// Default slave address of the RTD2660 family ISP interface
+	const uint8_t DEFAULT_ADDRESS = 0x4A;
+	// The probes must finish in this time, slow or hanging adapters are reported as timeout
+	// (a probe past it still leaves the ISP mode, the scan waits for that)
+	const unsigned int TIME_BUDGET_MS = 5000;
+
+	struct result_s {
+		std::string name;       // cache key, can be used with -d instead of the bus number
+		int adapter;
+		uint8_t address;
+		std::string controller;
+		uint32_t jedecId;
+		std::string flashName;
+		uint32_t flashSize;
+		std::string status;     // "ok" or the reason why nothing was found
+	};
+
+	std::vector<int> listAdapters();
+	std::vector<result_s> scan(std::vector<uint8_t> addresses, unsigned int timeoutMs);
+	void printTable(std::vector<result_s> &results);
+
+	std::string cachePath();
+	void saveCache(std::vector<result_s> &results);
+	bool lookup(std::string name, result_s &result);
+
+};
@@ -0,0 +1,343 @@
+#include <plog/Log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sstream>
+#include <stdexcept>
+
+#include "server.h"
+#include "scanner.h"
+#include "firmware.h"
+#include "patch.h"
+#include "catalogue.h"
+
+using namespace server;
+
+std::string server::defaultSocketPath() {
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	if (runtime != NULL && runtime[0] != 0) return std::string(runtime) + "/odc_prog.sock";
+	return "/tmp/odc_prog.sock";
+}
+
+static uint32_t parseNumber(std::string value) {
+	char *end;
+	unsigned long result = strtoul(value.c_str(), &end, 0);
+	if (value.empty() || *end != 0) throw std::runtime_error("Invalid number: " + value);
+	return result;
+}
+
+/*
+	bus
+*/
+
+bus::bus(int adapter, uint8_t address, std::string deviceType) {
+	this->adapter = adapter;
+	this->address = address;
+	this->deviceType = deviceType;
+	this->session = NULL;
+	this->opened = false;
+	this->stopping = false;
+
+	this->worker = std::thread(&bus::run, this);
+}
+
+std::string bus::submit(std::vector<std::string> args) {
+	job_s job;
+	job.args = args;
+	std::future<std::string> result = job.result.get_future();
+
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (this->stopping) return "error the daemon is shutting down";
+		this->queue.push_back(&job);
+	}
+	this->wakeup.notify_one();
+
+	return result.get();
+}
+
+std::string bus::status() {
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	std::stringstream status;
+	status << "i2c-" << this->adapter << "-" << std::hex << (int)this->address << ":" << (this->opened ? "open" : "closed")
+		<< ":" << std::dec << this->queue.size();
+	return status.str();
+}
+
+void bus::run() {
+	while (1) {
+		job_s *job;
+
+		{
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->wakeup.wait(guard, [this]() { return this->stopping || !this->queue.empty(); });
+			if (this->queue.empty()) break; // stopping and drained
+			job = this->queue.front();
+			this->queue.pop_front();
+		}
+
+		std::string result;
+		try {
+			result = "ok" + this->execute(job->args);
+		} catch(devices::exception& e) {
+			result = "error device exception: " + std::string(e.what());
+		} catch(i2c::exception& e) {
+			result = "error i2c exception: " + std::string(e.what());
+		} catch(stream::exception& e) {
+			result = "error stream exception: " + std::string(e.what());
+		} catch(patch::exception& e) {
+			result = "error patch exception: " + std::string(e.what());
+		} catch(catalogue::exception& e) {
+			result = "error catalogue exception: " + std::string(e.what());
+		} catch(std::exception& e) {
+			result = "error " + std::string(e.what());
+		} catch(...) {
+			result = "error unknown exception";
+		}
+
+		// A failed job may have left the ISP mode too
+		if (this->session != NULL) this->opened = this->session->isOpened();
+
+		job->result.set_value(result);
+	}
+
+	// Leave the devices in normal mode when the daemon stops
+	if (this->session != NULL) {
+		try {
+			this->session->close();
+		} catch(...) {
+			PLOG_WARNING << "[daemon] Unable to close the session on i2c-" << this->adapter;
+		}
+		this->opened = this->session->isOpened();
+	}
+}
+
+std::string bus::execute(std::vector<std::string> &args) {
+	std::string command = args[0];
+
+	if (this->session == NULL) this->session = new isp::session(this->adapter, this->address, this->deviceType);
+
+	if (command == "close") {
+		this->session->close();
+		return "";
+	}
+
+	if (command == "pipeline" && args.size() == 2 && (args[1] == "on" || args[1] == "off")) {
+		this->session->getDevice()->setProgramPipeline(args[1] == "on");
+		return "";
+	}
+
+	// Every other command needs the ISP mode, it is entered only once per session
+	this->session->open();
+
+	devices::device *device = this->session->getDevice();
+	flash::device *flash = this->session->getFlash();
+
+	std::stringstream result;
+
+	if (command == "open") {
+		// nothing to do
+	} else if (command == "info") {
+		result << " " << flash->getName() << " " << flash->getManufacturerName() << " " << flash->getSize();
+	} else if (command == "crc" && args.size() == 3) {
+		uint8_t crc = device->calculateCRC(parseNumber(args[1]), parseNumber(args[2]));
+		result << " " << std::hex << std::setfill('0') << std::setw(2) << (int)crc;
+	} else if (command == "read" && args.size() == 4) {
+		firmware::read(this->session, args[3], parseNumber(args[1]), parseNumber(args[2]));
+	} else if (command == "verify" && args.size() == 3) {
+		firmware::verify(this->session, args[2], parseNumber(args[1]));
+	} else if (command == "upload" && args.size() == 2) {
+		firmware::upload(this->session, args[1]);
+	} else if (command == "patch" && args.size() == 3) {
+		std::vector<uint8_t> data = patch::parseBytes(args[2]);
+		patch::stats_s stats = patch::write(this->session, parseNumber(args[1]), &data[0], data.size());
+		result << " " << std::dec << stats.sectors << " " << stats.erased << " " << stats.programmed;
+	} else if (command == "identify" && args.size() == 2) {
+		catalogue::catalogue_s known;
+		catalogue::load(args[1], known);
+		catalogue::match_s match = catalogue::identify(this->session, known);
+		result << " " << (match.entry != -1 ? known.entries[match.entry].name : "unknown");
+	} else throw std::runtime_error("Unknown command or wrong arguments: " + command);
+
+	return result.str();
+}
+
+bus::~bus() {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->wakeup.notify_one();
+
+	if (this->worker.joinable()) this->worker.join();
+
+	delete this->session;
+}
+
+/*
+	daemon
+*/
+
+daemon::daemon(std::string socketPath, std::string deviceType, uint8_t defaultAddress) {
+	this->socketPath = socketPath;
+	this->deviceType = deviceType;
+	this->defaultAddress = defaultAddress;
+	this->listenFd = -1;
+	this->stopping = false;
+}
+
+bus *daemon::getBus(std::string name) {
+	int adapter;
+	uint8_t address = this->defaultAddress;
+
+	// The same naming as -d: a bus number, or a device name from the last scan
+	if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos) {
+		adapter = atoi(name.c_str());
+	} else {
+		scanner::result_s cached;
+		if (!scanner::lookup(name, cached)) throw std::runtime_error("Unknown device name: " + name);
+		adapter = cached.adapter;
+		address = cached.address;
+	}
+
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	// One worker per device: a scanned name may point to another slave address of a known adapter
+	std::pair<int, uint8_t> key(adapter, address);
+	std::map<std::pair<int, uint8_t>, bus*>::iterator it = this->buses.find(key);
+	if (it != this->buses.end()) return it->second;
+
+	PLOG_INFO << "[daemon] New bus worker for i2c-" << adapter << " (address 0x" << std::hex << (int)address << ")";
+	bus *b = new bus(adapter, address, this->deviceType);
+	this->buses[key] = b;
+	return b;
+}
+
+std::string daemon::dispatch(std::string line) {
+	std::vector<std::string> args;
+	std::istringstream tokens(line);
+	std::string token;
+	while (tokens >> token) args.push_back(token);
+
+	if (args.empty()) return "error empty request";
+
+	if (args[0] == "shutdown") {
+		this->stopping = true;
+		// wake up the accept()
+		::shutdown(this->listenFd, SHUT_RDWR);
+		return "ok";
+	}
+
+	if (args[0] == "status") {
+		std::lock_guard<std::mutex> guard(this->lock);
+		std::string result = "ok";
+		for (std::map<std::pair<int, uint8_t>, bus*>::iterator it = this->buses.begin(); it != this->buses.end(); ++it) {
+			result += " " + it->second->status();
+		}
+		return result;
+	}
+
+	if (args.size() < 2) return "error missing command";
+
+	bus *b;
+	try {
+		b = this->getBus(args[0]);
+	} catch(i2c::exception& e) {
+		return "error i2c exception: " + std::string(e.what());
+	} catch(std::exception& e) {
+		return "error " + std::string(e.what());
+	}
+
+	args.erase(args.begin());
+	return b->submit(args);
+}
+
+void daemon::serveClient(int fd) {
+	std::string pending;
+	char buffer[512];
+
+	while (1) {
+		ssize_t readed = ::read(fd, buffer, sizeof(buffer));
+		if (readed <= 0) break;
+		pending.append(buffer, readed);
+
+		size_t pos;
+		while ((pos = pending.find('\n')) != std::string::npos) {
+			std::string line = pending.substr(0, pos);
+			pending.erase(0, pos + 1);
+
+			PLOG_DEBUG << "[daemon] Request: " << line;
+			std::string response = this->dispatch(line) + "\n";
+
+			// A client gone before its answer must not kill the daemon with SIGPIPE
+			if (send(fd, response.c_str(), response.size(), MSG_NOSIGNAL) < 0) break;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->clients.erase(fd);
+	::close(fd);
+	this->disconnected.notify_all();
+}
+
+void daemon::run() {
+	this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (this->listenFd < 0) throw std::runtime_error("Unable to create the socket");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (this->socketPath.size() >= sizeof(addr.sun_path)) throw std::runtime_error("The socket path is too long");
+	strcpy(addr.sun_path, this->socketPath.c_str());
+
+	unlink(this->socketPath.c_str());
+
+	if (bind(this->listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) throw std::runtime_error("Unable to bind the socket: " + this->socketPath);
+	if (listen(this->listenFd, 16) < 0) throw std::runtime_error("Unable to listen on the socket");
+
+	PLOG_INFO << "[daemon] Listening on " << this->socketPath;
+
+	bool failed = false;
+
+	while (!this->stopping) {
+		int fd = accept(this->listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (this->stopping) break;
+			if (errno == EINTR) continue;
+			failed = true;
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(this->lock);
+			this->clients.insert(fd);
+		}
+
+		// A finished client leaves nothing behind, a test station may connect for every job
+		std::thread(&daemon::serveClient, this, fd).detach();
+	}
+
+	PLOG_INFO << "[daemon] Shutting down";
+
+	{
+		// the running requests are finished, the idle clients are disconnected
+		std::unique_lock<std::mutex> guard(this->lock);
+		for (std::set<int>::iterator it = this->clients.begin(); it != this->clients.end(); ++it) ::shutdown(*it, SHUT_RD);
+		this->disconnected.wait(guard, [this]() { return this->clients.empty(); });
+	}
+
+	if (failed) throw std::runtime_error("Unable to accept the connection");
+}
+
+daemon::~daemon() {
+	for (std::map<std::pair<int, uint8_t>, bus*>::iterator it = this->buses.begin(); it != this->buses.end(); ++it) delete it->second;
+
+	if (this->listenFd >= 0) {
+		::close(this->listenFd);
+		unlink(this->socketPath.c_str());
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "session.h"
+
+namespace server {
+
+	// Long running programmer: the ISP sessions stay opened between the jobs.
+	// Protocol: one request per line on a unix stream socket, "<bus> <command> [arguments]",
+	// answered by "ok [result]" or "error <message>". <bus> is an adapter number or a scanned device name.
+	//
+	//   <bus> open                        enter ISP mode and detect the flash
+	//   <bus> info                        flash name / jedec ID / size
+	//   <bus> crc <start> <end>           hardware CRC of a range
+	//   <bus> read <address> <size> <file>
+	//   <bus> verify <address> <file>
+	//   <bus> upload <file>
+	//   <bus> patch <address> <hex bytes>  rewrite only the touched erase sectors
+	//   <bus> identify <catalogue>        name of the installed firmware, or "unknown"
+	//   <bus> pipeline on|off             overlapped page upload of the next writes (off by default)
+	//   <bus> close                       exit ISP mode (the device restarts)
+	//   status                            list of the bus workers, "i2c-<adapter>-<address>:open|closed:<queued jobs>"
+	//   shutdown
+
+	std::string defaultSocketPath();
+
+	struct job_s {
+		std::vector<std::string> args;
+		std::promise<std::string> result;
+	};
+
+	// Jobs of one device (adapter and slave address) are executed in order by its worker, different devices run in parallel
+	class bus {
+		private:
+			int adapter;
+			uint8_t address;
+			std::string deviceType;
+
+			// Owned by the worker thread, the others see only the published ISP state
+			isp::session *session;
+			std::atomic<bool> opened;
+
+			std::thread worker;
+			std::mutex lock;
+			std::condition_variable wakeup;
+			std::deque<job_s*> queue;
+			bool stopping;
+
+			void run();
+			std::string execute(std::vector<std::string> &args);
+
+		public:
+			bus(int adapter, uint8_t address, std::string deviceType);
+			~bus();
+
+			std::string submit(std::vector<std::string> args);
+			std::string status();
+	};
+
+	class daemon {
+		private:
+			std::string socketPath;
+			std::string deviceType;
+			uint8_t defaultAddress;
+
+			int listenFd;
+			std::atomic<bool> stopping;
+
+			std::mutex lock;
+			std::map<std::pair<int, uint8_t>, bus*> buses;
+			// The client threads are detached, run() waits for the last one through this set
+			std::set<int> clients;
+			std::condition_variable disconnected;
+
+			void serveClient(int fd);
+			std::string dispatch(std::string line);
+			bus *getBus(std::string name);
+
+		public:
+			daemon(std::string socketPath, std::string deviceType, uint8_t defaultAddress);
+			~daemon();
+
+			void run();
+	};
+
+};
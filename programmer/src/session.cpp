@@ -0,0 +1,128 @@
+#include <plog/Log.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "session.h"
+#include "devices/rtd2660.h"
+
+using namespace isp;
+
+std::string isp::writeSizePath() {
+	const char *cache = getenv("XDG_CACHE_HOME");
+	if (cache != NULL && cache[0] != 0) return std::string(cache) + "/odc_prog/writes";
+
+	const char *home = getenv("HOME");
+	if (home != NULL && home[0] != 0) return std::string(home) + "/.cache/odc_prog/writes";
+
+	return "odc_writes";
+}
+
+session::session(int adapter, uint8_t address, std::string deviceType) {
+	this->adapter = adapter;
+	this->address = address;
+	this->flash = NULL;
+	this->device = NULL;
+
+	this->conn = new i2c::connection(adapter, address);
+
+	if (deviceType == "rtd2660") this->device = new devices::rtd2660(this->conn);
+	else if (deviceType == "rtd2662") this->device = new devices::rtd2662(this->conn);
+	else {
+		delete this->conn;
+		throw devices::exception("Unknown device: " + deviceType);
+	}
+}
+
+void session::open() {
+	if (this->isOpened()) return;
+
+	PLOG_INFO << "Enter ISP mode";
+	this->device->enterISPMode();
+
+	PLOG_INFO << "Query info about the flash chip";
+
+	uint32_t flashJedecId = this->device->getFlashJedecID();
+	this->flash = new flash::device(flashJedecId);
+
+	PLOG_INFO << "Flash device detected (jedec ID: " << std::hex << flashJedecId << " / Manufacturer: " << this->flash->getManufacturerName() << " / Name: " << this->flash->getName() << ")";
+
+	this->device->setFlashDevice(this->flash);
+	this->device->probeTransferSize();
+	this->loadWriteSize();
+}
+
+void session::loadWriteSize() {
+	std::ifstream file(isp::writeSizePath().c_str());
+	if (!file) return;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream entry(line);
+		int adapter, address;
+		uint32_t jedecId;
+		size_t size;
+
+		entry >> adapter >> address >> jedecId >> size;
+		if (!entry || adapter != this->adapter || address != this->address || jedecId != this->flash->getJedecId()) continue;
+
+		// Never above the probed reads: the adapter or the bus may have changed since the validation
+		if (size > this->conn->getMaxTransferSize()) size = this->conn->getMaxTransferSize();
+		this->conn->setMaxWriteSize(size);
+		PLOG_INFO << "Validated page write size: " << std::dec << this->conn->getMaxWriteSize() << " byte";
+		return;
+	}
+}
+
+void session::saveWriteSize() {
+	if (!this->isOpened()) return;
+
+	std::string path = isp::writeSizePath();
+	std::vector<std::string> lines;
+
+	// The entries of the other devices are kept
+	std::ifstream input(path.c_str());
+	std::string line;
+	while (std::getline(input, line)) {
+		std::istringstream entry(line);
+		int adapter, address;
+		uint32_t jedecId;
+
+		entry >> adapter >> address >> jedecId;
+		if (!entry || (adapter == this->adapter && address == this->address && jedecId == this->flash->getJedecId())) continue;
+		lines.push_back(line);
+	}
+	input.close();
+
+	// create the parent directories
+	for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+		mkdir(path.substr(0, pos).c_str(), 0755);
+	}
+
+	std::ofstream output(path.c_str(), std::ios::trunc);
+	if (!output) {
+		PLOG_WARNING << "Unable to write the page write sizes: " << path;
+		return;
+	}
+
+	for (size_t i = 0; i < lines.size(); i++) output << lines[i] << std::endl;
+	output << std::dec << this->adapter << " " << (int)this->address << " " << this->flash->getJedecId() << " " << this->conn->getMaxWriteSize() << std::endl;
+}
+
+void session::close() {
+	if (!this->isOpened()) return;
+
+	PLOG_INFO << "Exit from ISP mode, the device will be restart after this";
+	this->device->setFlashDevice(NULL);
+	this->device->exitISPMode();
+
+	delete this->flash;
+	this->flash = NULL;
+}
+
+session::~session() {
+	delete this->flash;
+	delete this->device;
+	delete this->conn;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include "i2c.h"
+#include "flash.h"
+#include "devices/device.h"
+
+namespace isp {
+
+	// Page write sizes validated on the devices (see the bench mode), one "<adapter> <address> <jedec ID> <size>" line each
+	std::string writeSizePath();
+
+	// One display controller on one bus: the i2c connection, the device driver and the detected flash.
+	// open() enters the ISP mode and sets up the flash once, the session stays warm until close()
+
+	class session {
+		private:
+			int adapter;
+			uint8_t address;
+
+			i2c::connection *conn;
+			devices::device *device;
+			flash::device *flash;
+
+			void loadWriteSize();
+
+		public:
+			session(int adapter, uint8_t address, std::string deviceType);
+			~session();
+
+			bool isOpened() {return this->flash != NULL;};
+			void open();
+			void close();
+
+			// Keeps the page write size of the connection for this device, open() applies it from then on
+			void saveWriteSize();
+
+			int getAdapter() {return this->adapter;};
+			uint8_t getAddress() {return this->address;};
+			i2c::connection *getConnection() {return this->conn;};
+			devices::device *getDevice() {return this->device;};
+			flash::device *getFlash() {return this->flash;};
+	};
+
+};
@@ -0,0 +1,178 @@
+#include <string.h>
+#include <stdexcept>
+#include <CRC.h>
+#include "simulator.h"
+#include "flash.h"
+#include "bits.h"
+#include "devices/rtd2660.h"
+
+using namespace simulator;
+
+rtd2660::rtd2660(uint32_t jedecId) {
+	flash::device desc(jedecId);
+
+	this->jedecId = jedecId;
+	this->flash.assign(desc.getSize(), 0xFF);
+	this->blockSize = desc.getBlockSize();
+
+	memset(this->regs, 0, sizeof(this->regs));
+	memset(this->scaler, 0, sizeof(this->scaler));
+	memset(this->scalerPages, 0, sizeof(this->scalerPages));
+	memset(this->sram, 0xFF, sizeof(this->sram));
+	this->scalerAddress = 0;
+	this->sramLength = 0;
+	this->readPointer = 0;
+	this->bank = 0;
+}
+
+void rtd2660::load(const uint8_t *image, size_t size) {
+	if (size > this->flash.size()) throw std::runtime_error("The image is larger than the simulated flash");
+	memcpy(&this->flash[0], image, size);
+}
+
+uint32_t rtd2660::ispAddress() {
+	return (this->regs[devices::RTD2660::registers::flash_prog_isp0] << 16)
+		| (this->regs[devices::RTD2660::registers::flash_prog_isp1] << 8)
+		| this->regs[devices::RTD2660::registers::flash_prog_isp2];
+}
+
+uint8_t &rtd2660::scalerRegister(uint8_t address) {
+	// 0xa0-0xff are paged, the page is selected by 0x9f
+	if (address >= 0xa0) return this->scalerPages[this->scaler[0x9f] & 0x0f][address - 0xa0];
+	return this->scaler[address];
+}
+
+uint32_t rtd2660::flashAddress(uint32_t address) {
+	return this->bank * flash::device::BANK_SIZE + address;
+}
+
+void rtd2660::commonInstruction() {
+	uint8_t reg_value = this->regs[devices::RTD2660::registers::common_inst_en];
+	uint8_t type = reg_value >> devices::RTD2660::bf_common_inst_en::comm_inst;
+	uint8_t writeNum = (reg_value >> devices::RTD2660::bf_common_inst_en::write_num) & 0b11;
+	uint8_t opCode = this->regs[devices::RTD2660::registers::common_op_code];
+
+	uint32_t writeValue = this->ispAddress() >> (8 * (3 - writeNum));
+	if (writeNum == 0) writeValue = 0;
+
+	uint8_t *ports = &this->regs[devices::RTD2660::registers::common_inst_read_port0];
+
+	switch (type) {
+		case devices::RTD2660::v_comm_inst::read:
+			if (opCode == 0x9f) {
+				ports[0] = this->jedecId >> 16;
+				ports[1] = this->jedecId >> 8;
+				ports[2] = this->jedecId;
+			} else if (opCode == 0x05) {
+				ports[0] = 0x00; // never busy
+			} else {
+				// read / fast read: the data port streams from this address
+				this->readPointer = this->flashAddress(writeValue);
+			}
+			break;
+
+		case devices::RTD2660::v_comm_inst::erase: {
+			uint32_t eraseSize = 0;
+			if (opCode == 0xc7 || opCode == 0x60) eraseSize = this->flash.size();
+			else if (opCode == 0xd8) eraseSize = this->blockSize;
+			else if (opCode == 0x52) eraseSize = 32 * 1024;
+			else if (opCode == 0x20) eraseSize = 4 * 1024;
+
+			if (eraseSize > 0) {
+				uint32_t start = (eraseSize == this->flash.size()) ? 0 : this->flashAddress(writeValue & ~(eraseSize - 1));
+				for (uint32_t i = start; i < start + eraseSize && i < this->flash.size(); i++) this->flash[i] = 0xFF;
+			}
+			break;
+		}
+
+		case devices::RTD2660::v_comm_inst::write_after_WREN:
+			// Write Extended Address Register: the bank of the 3 byte addresses
+			if (opCode == 0xc5) this->bank = writeValue;
+			break;
+
+		default:
+			// status register writes and the protection have no effect on the model
+			break;
+	}
+
+	BIT_CLEAR(this->regs[devices::RTD2660::registers::common_inst_en], devices::RTD2660::bf_common_inst_en::comm_inst_en);
+}
+
+void rtd2660::programInstruction() {
+	uint8_t &reg_value = this->regs[devices::RTD2660::registers::program_instruction];
+
+	if (BIT_CHECK(reg_value, devices::RTD2660::bf_program_instruction::crc_start)) {
+		uint32_t start = this->flashAddress(this->ispAddress());
+		uint32_t end = this->flashAddress((this->regs[devices::RTD2660::registers::CRC_end_addr0] << 16)
+			| (this->regs[devices::RTD2660::registers::CRC_end_addr1] << 8)
+			| this->regs[devices::RTD2660::registers::CRC_end_addr2]);
+
+		uint8_t crc = 0;
+		if (end >= start && end < this->flash.size()) crc = CRC::Calculate(&this->flash[start], end - start + 1, CRC::CRC_8());
+
+		this->regs[devices::RTD2660::registers::CRC_result] = crc;
+		BIT_CLEAR(reg_value, devices::RTD2660::bf_program_instruction::crc_start);
+		BIT_SET(reg_value, devices::RTD2660::bf_program_instruction::crc_done);
+	}
+
+	if (BIT_CHECK(reg_value, devices::RTD2660::bf_program_instruction::prog_en)) {
+		uint32_t address = this->flashAddress(this->ispAddress());
+		size_t length = this->regs[devices::RTD2660::registers::program_length] + 1;
+
+		// Page program: only 1 -> 0 transitions, the address wraps inside the page
+		for (size_t i = 0; i < length; i++) {
+			uint32_t target = (address & ~0xFFu) | ((address + i) & 0xFF);
+			if (target < this->flash.size()) this->flash[target] &= this->sram[i];
+		}
+
+		memset(this->sram, 0xFF, sizeof(this->sram));
+		this->sramLength = 0;
+		BIT_CLEAR(reg_value, devices::RTD2660::bf_program_instruction::prog_en);
+	}
+}
+
+void rtd2660::write(uint8_t reg, uint8_t data) {
+	switch (reg) {
+		case devices::RTD2660::registers::program_data_port:
+			this->sram[this->sramLength & 0xFF] = data;
+			this->sramLength++;
+			return;
+
+		case devices::RTD2660::registers::program_length:
+			this->regs[reg] = data;
+			this->sramLength = 0;
+			return;
+
+		case devices::RTD2660::registers::SCA_INF_ADDR:
+			this->scalerAddress = data;
+			return;
+
+		case devices::RTD2660::registers::SCA_INF_DATA:
+			this->scalerRegister(this->scalerAddress) = data;
+			if (!BIT_CHECK(this->regs[devices::RTD2660::registers::SCA_INF_CONTROL], devices::RTD2660::bf_SCA_INF_CONTROL::addr_non_inc)) this->scalerAddress++;
+			return;
+	}
+
+	this->regs[reg] = data;
+
+	if (reg == devices::RTD2660::registers::common_inst_en && BIT_CHECK(data, devices::RTD2660::bf_common_inst_en::comm_inst_en)) this->commonInstruction();
+	if (reg == devices::RTD2660::registers::program_instruction) this->programInstruction();
+}
+
+uint8_t rtd2660::read(uint8_t reg) {
+	switch (reg) {
+		case devices::RTD2660::registers::program_data_port: {
+			uint8_t data = this->flash[this->readPointer % this->flash.size()];
+			this->readPointer++;
+			return data;
+		}
+
+		case devices::RTD2660::registers::SCA_INF_DATA: {
+			uint8_t data = this->scalerRegister(this->scalerAddress);
+			if (!BIT_CHECK(this->regs[devices::RTD2660::registers::SCA_INF_CONTROL], devices::RTD2660::bf_SCA_INF_CONTROL::addr_non_inc)) this->scalerAddress++;
+			return data;
+		}
+	}
+
+	return this->regs[reg];
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+namespace simulator {
+
+	// Register level model of the RTD2660 ISP interface with an SPI flash behind it.
+	// Good enough to replay the programmer's own transactions: common instructions
+	// (JEDEC ID, read, erase, status writes), page program through the SRAM buffer,
+	// hardware CRC and the scaler interface ports.
+
+	class rtd2660 {
+		private:
+			uint8_t regs[256];
+			uint8_t scaler[256];
+			uint8_t scalerPages[16][0x60];
+			uint8_t scalerAddress;
+			uint8_t &scalerRegister(uint8_t address);
+
+			uint32_t jedecId;
+			std::vector<uint8_t> flash;
+			uint32_t blockSize;
+
+			uint8_t sram[256];
+			size_t sramLength;
+			uint32_t readPointer;
+			uint8_t bank; // extended address register of the flash
+
+			uint32_t ispAddress();
+			uint32_t flashAddress(uint32_t address);
+			void commonInstruction();
+			void programInstruction();
+
+		public:
+			rtd2660(uint32_t jedecId);
+
+			void load(const uint8_t *image, size_t size);
+			const std::vector<uint8_t>& getFlash() {return this->flash;};
+
+			void write(uint8_t reg, uint8_t data);
+			uint8_t read(uint8_t reg);
+	};
+
+};
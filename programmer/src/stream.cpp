@@ -0,0 +1,78 @@
+#include <plog/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+
+using namespace stream;
+
+file::file(const std::string filename, bool output) {
+	this->output = output;
+	this->filename = filename;
+	this->standard = (filename == "-");
+
+	if (this->standard) {
+		this->fd = output ? STDOUT_FILENO : STDIN_FILENO;
+		PLOG_DEBUG << "[stream] Using " << (output ? "stdout" : "stdin");
+		return;
+	}
+
+	if (output) this->fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	else this->fd = ::open(filename.c_str(), O_RDONLY);
+
+	if (this->fd < 0) throw stream::exception("Unable to open the file: " + filename);
+}
+
+void file::setPipeSize(size_t size) {
+	// Only meaningful for pipes: a pipe buffer as large as the write window
+	// lets the consumer (compressor, uploader) drain a whole window at once
+	struct stat st;
+	if (fstat(this->fd, &st) < 0 || !S_ISFIFO(st.st_mode)) return;
+
+#ifdef F_SETPIPE_SZ
+	if (fcntl(this->fd, F_SETPIPE_SZ, (int)size) < 0) PLOG_DEBUG << "[stream] Unable to resize the pipe buffer";
+	else PLOG_DEBUG << "[stream] Pipe buffer resized to " << size << " byte";
+#endif
+}
+
+size_t file::read(uint8_t *buffer, size_t size) {
+	size_t total = 0;
+
+	// fill the whole buffer, pipes may return short reads
+	while (total < size) {
+		ssize_t readed = ::read(this->fd, buffer + total, size - total);
+		if (readed < 0) {
+			if (errno == EINTR) continue;
+			throw stream::exception("Unable to read the file: " + this->filename);
+		}
+		if (readed == 0) break; // EOF
+		total += readed;
+	}
+
+	return total;
+}
+
+void file::write(const uint8_t *buffer, size_t size) {
+	size_t total = 0;
+
+	while (total < size) {
+		ssize_t written = ::write(this->fd, buffer + total, size - total);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			throw stream::exception("Unable to write the file: " + this->filename);
+		}
+		total += written;
+	}
+}
+
+file::~file() {
+	if (!this->standard && this->fd >= 0) ::close(this->fd);
+}
+
+bool stream::isRegular(const std::string filename) {
+	struct stat st;
+	if (filename == "-" || stat(filename.c_str(), &st) < 0) return false;
+	return S_ISREG(st.st_mode);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <exception>
+
+namespace stream {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	// Unbuffered file wrapper, "-" means stdin (input) or stdout (output)
+	// The callers are expected to read/write in large windows (flash block size),
+	// every call maps to as few syscalls as possible
+
+	class file {
+		private:
+			int fd;
+			bool output;
+			bool standard;
+			std::string filename;
+
+		public:
+			file(const std::string filename, bool output);
+
+			bool isStandard() {return this->standard;};
+			std::string getName() {return this->filename;};
+
+			void setPipeSize(size_t size);
+
+			size_t read(uint8_t *buffer, size_t size);
+			void write(const uint8_t *buffer, size_t size);
+
+			~file();
+	};
+
+	// True if the file can be mapped and planned as a whole ("-" and pipes are consumed once)
+	bool isRegular(const std::string filename);
+
+};
@@ -0,0 +1,129 @@
+#include <plog/Log.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+using namespace trace;
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+const char* trace::opName(uint8_t op) {
+	switch (op) {
+		case op_write:       return "write";
+		case op_read:        return "read";
+		case op_write_block: return "write_block";
+		case op_read_block:  return "read_block";
+		case op_write_raw:   return "write_raw";
+		case op_read_raw:    return "read_raw";
+	}
+	return "unknown";
+}
+
+bool trace::isWrite(uint8_t op) {
+	return op == op_write || op == op_write_block || op == op_write_raw;
+}
+
+uint64_t trace::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+	recorder
+*/
+
+recorder::recorder(std::string filename, int adapter, uint8_t address) {
+	this->fp = fopen(filename.c_str(), "wb");
+	if (this->fp == NULL) throw trace::exception("Unable to open the trace file: " + filename);
+
+	// the records are small, let the stdio buffer collect them
+	setvbuf(this->fp, NULL, _IOFBF, 64 * 1024);
+
+	uint8_t header[8] = {'O', 'D', 'C', 'T'};
+	put16(header + 4, VERSION);
+	header[6] = adapter;
+	header[7] = address;
+	fwrite(header, 1, sizeof(header), this->fp);
+
+	this->origin = trace::now();
+	this->previous = this->origin;
+
+	PLOG_INFO << "[trace] Recording i2c transactions into " << filename;
+}
+
+void recorder::record(uint8_t op, uint8_t reg, const uint8_t *payload, size_t length, uint8_t status, uint64_t start) {
+	uint64_t end = trace::now();
+
+	if (start < this->previous) start = this->previous;
+	uint64_t delta = (start - this->previous) / 1000;
+	uint64_t duration = end - start;
+	this->previous += delta * 1000; // the rounding error is carried into the next delta
+
+	uint8_t header[14];
+	header[0] = op;
+	header[1] = reg;
+	header[2] = status;
+	header[3] = 0;
+	put32(header + 4, delta > 0xFFFFFFFF ? 0xFFFFFFFF : delta);
+	put32(header + 8, duration > 0xFFFFFFFF ? 0xFFFFFFFF : duration);
+	put16(header + 12, length);
+
+	fwrite(header, 1, sizeof(header), this->fp);
+	if (length > 0) fwrite(payload, 1, length, this->fp);
+}
+
+recorder::~recorder() {
+	if (this->fp != NULL) fclose(this->fp);
+}
+
+/*
+	reader
+*/
+
+reader::reader(std::string filename) {
+	this->fp = fopen(filename.c_str(), "rb");
+	if (this->fp == NULL) throw trace::exception("Unable to open the trace file: " + filename);
+
+	uint8_t header[8];
+	if (fread(header, 1, sizeof(header), this->fp) != sizeof(header) || memcmp(header, "ODCT", 4) != 0) {
+		fclose(this->fp);
+		throw trace::exception("Not a trace file: " + filename);
+	}
+	if (get16(header + 4) != VERSION) {
+		fclose(this->fp);
+		throw trace::exception("Unsupported trace version: " + filename);
+	}
+
+	this->adapter = header[6];
+	this->address = header[7];
+	this->clock = 0;
+}
+
+bool reader::next(record_s &record) {
+	uint8_t header[14];
+	size_t readed = fread(header, 1, sizeof(header), this->fp);
+	if (readed == 0) return false;
+	if (readed != sizeof(header)) throw trace::exception("Truncated trace record");
+
+	record.op = header[0];
+	record.reg = header[1];
+	record.status = header[2];
+	this->clock += (uint64_t)get32(header + 4) * 1000;
+	record.start = this->clock;
+	record.duration = get32(header + 8);
+
+	record.payload.resize(get16(header + 12));
+	if (record.payload.size() > 0 && fread(&record.payload[0], 1, record.payload.size(), this->fp) != record.payload.size()) {
+		throw trace::exception("Truncated trace payload");
+	}
+
+	return true;
+}
+
+reader::~reader() {
+	if (this->fp != NULL) fclose(this->fp);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdio.h>
+#include <stdint.h>
+
+namespace trace {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	/*
+		Binary i2c transaction trace (little endian)
+
+		header: "ODCT" / uint16 version / uint8 adapter / uint8 address
+		record: uint8 op / uint8 register / uint8 status / uint8 reserved
+		        uint32 start (us since the previous record's start)
+		        uint32 duration (ns, saturated)
+		        uint16 length / payload[length] (the written or the readed data)
+	*/
+
+	const uint16_t VERSION = 1;
+
+	enum ops {
+		op_write       = 0,	// SMBus write byte
+		op_read        = 1,	// SMBus read byte
+		op_write_block = 2,	// SMBus i2c block write
+		op_read_block  = 3,	// SMBus i2c block read
+		op_write_raw   = 4,	// I2C_RDWR write
+		op_read_raw    = 5	// I2C_RDWR write + read
+	};
+
+	enum status {
+		status_ok      = 0,
+		status_failed  = 1,	// the transaction failed on the bus
+		status_refused = 2	// the adapter refused it, nothing went to the bus
+	};
+
+	struct record_s {
+		uint8_t op;
+		uint8_t reg;
+		uint8_t status;
+		uint64_t start;		// ns since the trace start
+		uint32_t duration;	// ns
+		std::vector<uint8_t> payload;
+	};
+
+	const char* opName(uint8_t op);
+	bool isWrite(uint8_t op);
+	uint64_t now();
+
+	class recorder {
+		private:
+			FILE *fp;
+			uint64_t origin;
+			uint64_t previous;
+
+		public:
+			recorder(std::string filename, int adapter, uint8_t address);
+			~recorder();
+
+			void record(uint8_t op, uint8_t reg, const uint8_t *payload, size_t length, uint8_t status, uint64_t start);
+	};
+
+	class reader {
+		private:
+			FILE *fp;
+			uint64_t clock;
+
+		public:
+			int adapter;
+			uint8_t address;
+
+			reader(std::string filename);
+			~reader();
+
+			bool next(record_s &record);
+	};
+
+};
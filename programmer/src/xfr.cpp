@@ -0,0 +1,212 @@
+#include <plog/Log.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xfr.h"
+
+using namespace xfr;
+
+// The RTD2660 and the RTD2662 share the scaler core, a controller with other ports gets its own table
+static const port_s rtd266xPorts[] = {
+	{-1, 0x00, 0x03, "id, host control, status 0/1"},
+	{-1, 0x24, 0x25, "scale down access port"},
+	{-1, 0x2a, 0x2b, "display format access port"},
+	{-1, 0x30, 0x31, "fifo window access port"},
+	{-1, 0x33, 0x36, "scale up / filter coefficient access ports"},
+	{-1, 0x5c, 0x5d, "sync processor access port"},
+	{-1, 0x62, 0x63, "sRGB access port"},
+	{-1, 0x64, 0x66, "contrast / brightness access port, gamma port"},
+	{-1, 0x68, 0x68, "dithering table port"},
+	{-1, 0x6e, 0x6f, "overlay color LUT port"},
+	{-1, 0x8b, 0x8c, "timing controller access port"},
+	{-1, 0x90, 0x92, "OSD address / data port"},
+	{2, 0xc9, 0xca, "HDMI access port"},
+	{7, 0xc9, 0xca, "DCC access port"}
+};
+
+static void ports(controller_e controller, const port_s *&list, size_t &count) {
+	switch (controller) {
+		case controller_rtd2660:
+		case controller_rtd2662:
+			list = rtd266xPorts;
+			count = sizeof(rtd266xPorts) / sizeof(rtd266xPorts[0]);
+			return;
+	}
+	throw xfr::exception("Unknown controller in the snapshot");
+}
+
+bool xfr::isPort(controller_e controller, int page, uint8_t reg) {
+	const port_s *list;
+	size_t count;
+	ports(controller, list, count);
+
+	for (size_t i = 0; i < count; i++) {
+		if (list[i].page == page && reg >= list[i].first && reg <= list[i].last) return true;
+	}
+	return false;
+}
+
+static controller_e controllerOf(devices::rtd2660 *) {return controller_rtd2660;}
+static controller_e controllerOf(devices::rtd2662 *) {return controller_rtd2662;}
+
+// Burst reads of the runs between the ports, the ports stay 0
+template <typename Controller> static void readRuns(Controller *device, controller_e controller, uint8_t base, uint8_t *values, int size, int page) {
+	memset(values, 0, size);
+
+	int i = 0;
+	while (i < size) {
+		if (isPort(controller, page, base + i)) {
+			i++;
+			continue;
+		}
+
+		int start = i;
+		while (i < size && !isPort(controller, page, base + i)) i++;
+
+		device->scalerRead(base + start, &values[start], i - start, true);
+	}
+}
+
+template <typename Controller> void xfr::capture(Controller *device, snapshot_s &snapshot) {
+	PLOG_DEBUG << "[xfr] Capture the scaler registers";
+
+	snapshot.controller = controllerOf(device);
+
+	readRuns(device, snapshot.controller, 0x00, snapshot.common, COMMON_SIZE, -1);
+
+	for (int page = 0; page < PAGE_COUNT; page++) {
+		device->scalerSetByte(PAGE_SELECT, page);
+		readRuns(device, snapshot.controller, PAGED_START, snapshot.pages[page], PAGE_SIZE, page);
+	}
+
+	// Back to the page of the running firmware
+	device->scalerSetByte(PAGE_SELECT, snapshot.common[PAGE_SELECT]);
+}
+
+// Burst writes of the differing runs, page is selected before the first one (-1: common registers)
+template <typename Controller> static size_t writeRuns(Controller *device, controller_e controller, uint8_t base, uint8_t *current, uint8_t *target, int size, int page, int skip) {
+	size_t written = 0;
+	bool selected = false;
+
+	auto differs = [&](int i) {
+		return current[i] != target[i] && i != skip && !isPort(controller, page, base + i);
+	};
+
+	int i = 0;
+	while (i < size) {
+		if (!differs(i)) {
+			i++;
+			continue;
+		}
+
+		int start = i;
+		while (i < size && differs(i)) i++;
+
+		if (page >= 0 && !selected) {
+			device->scalerSetByte(PAGE_SELECT, page);
+			selected = true;
+		}
+
+		PLOG_VERBOSE << "[xfr] Write " << std::dec << (i - start) << " register(s) from 0x" << std::hex << (int)(base + start);
+		device->scalerWrite(base + start, &target[start], i - start, true);
+		written += i - start;
+	}
+
+	return written;
+}
+
+template <typename Controller> size_t xfr::restore(Controller *device, snapshot_s &snapshot) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	snapshot_s current;
+	xfr::capture(device, current);
+
+	if (current.controller != snapshot.controller) throw xfr::exception("The snapshot was taken on another controller");
+
+	size_t written = 0;
+
+	for (int page = 0; page < PAGE_COUNT; page++) {
+		written += writeRuns(device, current.controller, PAGED_START, current.pages[page], snapshot.pages[page], PAGE_SIZE, page, -1);
+	}
+
+	written += writeRuns(device, current.controller, 0x00, current.common, snapshot.common, COMMON_SIZE, -1, PAGE_SELECT);
+
+	// The page select is the last one, the paged writes moved it
+	device->scalerSetByte(PAGE_SELECT, snapshot.common[PAGE_SELECT]);
+	if (current.common[PAGE_SELECT] != snapshot.common[PAGE_SELECT]) written++;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	PLOG_INFO << "[xfr] Restored " << std::dec << written << " register(s) in " << (int)ms << " ms";
+
+	return written;
+}
+
+template void xfr::capture(devices::rtd2660 *device, snapshot_s &snapshot);
+template void xfr::capture(devices::rtd2662 *device, snapshot_s &snapshot);
+template size_t xfr::restore(devices::rtd2660 *device, snapshot_s &snapshot);
+template size_t xfr::restore(devices::rtd2662 *device, snapshot_s &snapshot);
+
+void xfr::save(std::string filename, snapshot_s &snapshot) {
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (fp == NULL) throw xfr::exception("Unable to open the snapshot file: " + filename);
+
+	uint8_t header[7] = {'O', 'D', 'C', 'X', VERSION, PAGE_COUNT, (uint8_t)snapshot.controller};
+
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1
+		&& fwrite(snapshot.common, COMMON_SIZE, 1, fp) == 1
+		&& fwrite(snapshot.pages, sizeof(snapshot.pages), 1, fp) == 1;
+	fclose(fp);
+
+	if (!ok) throw xfr::exception("Unable to write the snapshot file: " + filename);
+}
+
+void xfr::load(std::string filename, snapshot_s &snapshot) {
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) throw xfr::exception("Unable to open the snapshot file: " + filename);
+
+	uint8_t header[7];
+	bool ok = fread(header, 6, 1, fp) == 1
+		&& memcmp(header, "ODCX", 4) == 0 && (header[4] == 1 || header[4] == VERSION) && header[5] == PAGE_COUNT;
+
+	// Version 1 has no controller byte, its ports were captured too (they are ignored from now on)
+	header[6] = controller_rtd2660;
+	if (ok && header[4] == VERSION) ok = fread(&header[6], 1, 1, fp) == 1 && header[6] <= controller_rtd2662;
+	snapshot.controller = (controller_e)header[6];
+
+	ok = ok
+		&& fread(snapshot.common, COMMON_SIZE, 1, fp) == 1
+		&& fread(snapshot.pages, sizeof(snapshot.pages), 1, fp) == 1;
+	fclose(fp);
+
+	if (!ok) throw xfr::exception("Not a snapshot file: " + filename);
+}
+
+size_t xfr::diff(snapshot_s &a, snapshot_s &b) {
+	size_t count = 0;
+
+	if (a.controller != b.controller) throw xfr::exception("The snapshots were taken on different controllers");
+
+	printf("%-6s %4s %4s %4s\n", "PAGE", "REG", "A", "B");
+
+	for (int i = 0; i < COMMON_SIZE; i++) {
+		if (a.common[i] == b.common[i] || isPort(a.controller, -1, i)) continue;
+		printf("%-6s 0x%02x 0x%02x 0x%02x\n", "common", i, a.common[i], b.common[i]);
+		count++;
+	}
+
+	for (int page = 0; page < PAGE_COUNT; page++) {
+		for (int i = 0; i < PAGE_SIZE; i++) {
+			if (a.pages[page][i] == b.pages[page][i] || isPort(a.controller, page, PAGED_START + i)) continue;
+			printf("%-6d 0x%02x 0x%02x 0x%02x\n", page, PAGED_START + i, a.pages[page][i], b.pages[page][i]);
+			count++;
+		}
+	}
+
+	printf("\n%u register(s) differ\n", (unsigned)count);
+
+	return count;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <exception>
+#include <stdint.h>
+#include "devices/rtd2660.h"
+
+namespace xfr {
+
+	class exception : public std::exception {
+		public:
+			exception(const std::string m="unnamed exception"):msg(m){};
+			const char* what(){return msg.c_str();};
+		private:
+			std::string msg;
+	};
+
+	// Scaler registers (XFR) behind SCA_INF_ADDR / SCA_INF_DATA: 0x00-0x9f are common,
+	// 0xa0-0xff are paged, the page is selected by the common register 0x9f
+	const uint8_t PAGE_SELECT = 0x9f;
+	const uint8_t PAGED_START = 0xa0;
+	const int COMMON_SIZE = 0xa0;
+	const int PAGE_SIZE = 0x60;
+	const int PAGE_COUNT = 16;
+
+	enum controller_e {
+		controller_rtd2660 = 0,
+		controller_rtd2662 = 1
+	};
+
+	// Port and status registers of a controller (page -1: common registers). A read moves the pointer
+	// of an access port or drains its data port, a write goes into an OSD / gamma / LUT table or clears
+	// status bits: these are never captured, restored or compared, they are 0 in the snapshot
+	struct port_s {
+		int page;
+		uint8_t first;
+		uint8_t last;
+		const char *name;
+	};
+
+	bool isPort(controller_e controller, int page, uint8_t reg);
+
+	/*
+		Snapshot file: "ODCX" / uint8 version / uint8 page count / uint8 controller
+		               common registers (0xa0 byte) / page 0..n registers (0x60 byte each)
+		(version 1 had no controller byte, it is read as an rtd2660 snapshot)
+	*/
+	const uint8_t VERSION = 2;
+
+	struct snapshot_s {
+		controller_e controller;
+		uint8_t common[COMMON_SIZE];
+		uint8_t pages[PAGE_COUNT][PAGE_SIZE];
+	};
+
+	// The monitor keeps running: the scaler interface works without the ISP mode
+	// (instantiated for devices::rtd2660 and devices::rtd2662)
+	template <typename Controller> void capture(Controller *device, snapshot_s &snapshot);
+	// Writes the registers which differ from the current values, returns their count
+	template <typename Controller> size_t restore(Controller *device, snapshot_s &snapshot);
+
+	void save(std::string filename, snapshot_s &snapshot);
+	void load(std::string filename, snapshot_s &snapshot);
+
+	// Prints the differing registers, returns their count (the snapshots of two controllers can't be compared)
+	size_t diff(snapshot_s &a, snapshot_s &b);
+
+};